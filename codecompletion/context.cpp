@@ -58,7 +58,16 @@ QList<CompletionTreeItemPointer> CompletionContext::completionItems(bool &abort,
     auto localContext = top->findContextAt(m_position);
     if (!localContext)
         return items; // Can it be null ?
-    ZigCompletion completion(complete_expr(m_text.toUtf8().constData(), m_followingText.toUtf8().constData()));
+    // Only the expression at the cursor is parsed so just convert and pass the
+    // current line (including the newline before it) instead of the whole document
+    const int lineStart = qMax(0, static_cast<int>(m_text.lastIndexOf(QLatin1Char('\n'))));
+    const int start = qMax(lineStart, static_cast<int>(m_text.size()) - maxCompletionWindow);
+    const QByteArray text = QStringView(m_text).mid(start).toUtf8();
+    const int lineEnd = m_followingText.indexOf(QLatin1Char('\n'));
+    const int followingSize = lineEnd < 0 ? maxCompletionWindow : qMin(lineEnd, maxCompletionWindow);
+    const QByteArray followingText = QStringView(m_followingText).left(followingSize).toUtf8();
+    ZigCompletion completion(complete_expr(
+        text.constData(), text.size(), followingText.constData(), followingText.size()));
     if (!completion.data())
         return items;
     CompletionResultType result_type = completion.data()->result_type;
@@ -59,6 +59,9 @@ public:
 
     QList<KDevelop::CompletionTreeItemPointer> completionsFromLocalDecls(const DUContextPointer &ctx) const;
 
+    // Max number of characters around the cursor given to the parser
+    static constexpr int maxCompletionWindow = 512;
+
 private:
     QString m_followingText;
 };
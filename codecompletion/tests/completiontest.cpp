@@ -239,7 +239,34 @@ void CompletionTest::testFieldAccess_data()
            "const y = x.b.%INVOKE" << "%CURSOR" << "a";
 
 }
+void CompletionTest::benchmarkCompletion()
+{
+    // Completion latency should not depend on the size of the document
+    QFETCH(int, lines);
+    QString code;
+    for (int i = 0; i < lines; i += 2) {
+        code += QStringLiteral("const A%1 = struct {a: u8, b: u8};\n\n").arg(i);
+    }
+    code += QStringLiteral("const x = A0{};\nconst y = x.%INVOKE");
+    const CompletionParameters data = prepareCompletion(code, QStringLiteral("%CURSOR"));
+    bool abort = false;
+    QBENCHMARK {
+        CompletionContext context(data.contextAtCursor, data.snip, data.remaining, data.cursorAt);
+        QList<CompletionTreeItem*> items;
+        const auto ptrs = context.completionItems(abort, true);
+        for (const CompletionTreeItemPointer &ptr: ptrs) {
+            items << ptr.data();
+        }
+        QVERIFY(containsItemForDeclarationNamed(items, QStringLiteral("a")));
+    }
+}
 
+void CompletionTest::benchmarkCompletion_data()
+{
+    QTest::addColumn<int>("lines");
+    QTest::newRow("1000 lines") << 1000;
+    QTest::newRow("10000 lines") << 10000;
+}
 
 } // Namespace zig
 
@@ -49,6 +49,8 @@ class CompletionTest : public QObject
     private Q_SLOTS:
         void testFieldAccess();
         void testFieldAccess_data();
+        void benchmarkCompletion();
+        void benchmarkCompletion_data();
 
     private:
         QList<CompletionTreeItemPointer> m_ptrs;
@@ -30,15 +30,6 @@
 namespace Zig
 {
 
-VisitResult contextBuilderVisitorCallback(ZAst* ast, NodeIndex node, NodeIndex parent, void *data)
-{
-    ContextBuilder *visitor = static_cast<ContextBuilder *>(data);
-    Q_ASSERT(visitor);
-    ZigNode childNode = {ast, node};
-    ZigNode parentNode = {ast, parent};
-    return visitor->visitNode(childNode, parentNode);
-}
-
 void ContextBuilder::setParseSession(ParseSession *session)
 {
     this->session = session;
@@ -99,35 +90,24 @@ VisitResult ContextBuilder::visitNode(const ZigNode &node, const ZigNode &parent
 bool ContextBuilder::shouldSkipNode(const ZigNode &node, const ZigNode &parent)
 {
     Q_UNUSED(parent);
-    const NodeKind kind = node.kind();
-    if (kind == VarDecl) {
-        // When we get a var decl followed by a container or error
-        // decl, skip making a separate declaration/context for the
-        // variable and just use the name.
-        // Eg const Foo = struct {}
-        ZigNode child = node.rhsAsNode();
-        NodeKind childKind = child.kind();
-        return (
-            childKind == ContainerDecl
-            || childKind == ErrorDecl
-            || childKind == EnumDecl
-            || childKind == UnionDecl
-            || (childKind == Call && child.spellingName() == QStringLiteral("@cImport"))
-            //|| (childKind == Call && child.spellingName() == "@import")
-        );
-    }
-    return false;
+    // When we get a var decl followed by a container or error
+    // decl, skip making a separate declaration/context for the
+    // variable and just use the name. Computed at parse time.
+    // Eg const Foo = struct {}
+    return node.flags() & NodeFlag_SkipDecl;
 }
 
 void ContextBuilder::visitChildren(const ZigNode &node, const ZigNode &parent)
 {
     Q_UNUSED(parent);
-    ast_visit(node.ast, node.index, contextBuilderVisitorCallback, this);
+    visitChildNodes(this, node);
 }
 
 
 void ContextBuilder::startVisiting(const ZigNode *node)
 {
+    // Each pass supersedes the types found by the previous one
+    session->invalidateExpressionCache();
     visitNode(*node, *node);
 }
 
@@ -35,8 +35,10 @@
 
 #include "expressionvisitor.h"
 #include "functionvisitor.h"
+#include "delayedtypevisitor.h"
 #include "nodetraits.h"
 #include "helpers.h"
+#include "importscheduler.h"
 #include "zigdebug.h"
 
 
@@ -52,22 +54,159 @@ ReferencedTopDUContext DeclarationBuilder::build(
 {
     ReferencedTopDUContext ctx(updateContext);
     //m_correctionHelper.reset(new CorrectionHelper(url, this));
-    // The declaration builder needs to run twice,
-    // so it can resolve uses of structs, functions, etc
-    // which are used before they are defined .
-    if ( ! m_prebuilding ) {
+    if (m_prebuilding) {
+        qCDebug(KDEV_ZIG) << "Prebuilding declarations";
+        return DeclarationBuilderBase::build(url, node, ctx);
+    }
+    if (!m_singlePass) {
+        // The declaration builder needs to run twice,
+        // so it can resolve uses of structs, functions, etc
+        // which are used before they are defined .
         DeclarationBuilder prebuilder;
         prebuilder.setParseSession(session);
         prebuilder.setPrebuilding(true);
         ctx = prebuilder.build(url, node, updateContext);
         qCDebug(KDEV_ZIG) << "Second declarationbuilder pass";
+        return DeclarationBuilderBase::build(url, node, ctx);
     }
-    else {
-        qCDebug(KDEV_ZIG) << "Prebuilding declarations";
+
+    // Types that use something declared further down are recorded
+    // and resolved once everything is declared
+    QList<ProblemPointer> problems;
+    if (ctx) {
+        DUChainReadLocker lock;
+        problems = ctx->problems();
+    }
+    m_deferring = true;
+    m_needsSecondPass = false;
+    ctx = DeclarationBuilderBase::build(url, node, ctx);
+    m_deferring = false;
+    if (!m_needsSecondPass) {
+        resolveDeferred();
+        return ctx;
+    }
+    m_deferred.clear();
+    qCDebug(KDEV_ZIG) << "Second declarationbuilder pass";
+    {
+        // The first pass acted as a prebuild
+        DUChainWriteLocker lock;
+        ctx->setProblems(problems);
     }
     return DeclarationBuilderBase::build(url, node, ctx);
 }
 
+void DeclarationBuilder::defer(DeferredKind kind, const ZigNode &node, const ZigNode &owner,
+                               Declaration *decl, int arg, const RangeInRevision &range)
+{
+    m_deferred.append(DeferredDecl{
+        kind, node, owner, currentContext(), DeclarationPointer(decl), arg, range, QString()
+    });
+}
+
+void DeclarationBuilder::resolveDeferred()
+{
+    // Resolving one declaration may resolve others that use it so
+    // repeat while something changes
+    constexpr int maxRounds = 8;
+    for (int round = 0; round < maxRounds && !m_deferred.isEmpty(); round++) {
+        // Results from before are superseded
+        session->invalidateExpressionCache();
+        const int pending = m_deferred.size();
+        QVector<DeferredDecl> unresolved;
+        for (DeferredDecl &entry : m_deferred) {
+            if (!resolveDeferredDecl(entry)) {
+                unresolved.append(entry);
+            }
+        }
+        m_deferred.swap(unresolved);
+        if (m_deferred.size() == pending) {
+            break;
+        }
+    }
+    for (const DeferredDecl &entry : std::as_const(m_deferred)) {
+        if (!entry.problem.isEmpty()) {
+            addHint(entry.range, entry.problem, entry.context->topContext());
+        }
+    }
+    m_deferred.clear();
+}
+
+bool DeclarationBuilder::resolveDeferredDecl(DeferredDecl &entry)
+{
+    Declaration *decl = entry.decl.data();
+    if (!decl) {
+        return true;
+    }
+    AbstractType::Ptr t;
+    switch (entry.kind) {
+    case DeferredValue:
+        t = varDeclType(entry.node, entry.context);
+        break;
+    case DeferredField:
+        t = fieldDeclType(entry.node, entry.context, decl);
+        break;
+    case DeferredParam: {
+        ExpressionVisitor v(session, entry.context);
+        v.startVisiting(entry.node, entry.owner);
+        t = v.lastType();
+        DUChainWriteLocker lock;
+        // Params are declared in the context owned by the fn
+        if (auto *fnDecl = entry.context->owner()) {
+            if (auto fn = fnDecl->type<FunctionType>()) {
+                fn->removeArgument(entry.arg);
+                fn->addArgument(t, entry.arg);
+                fnDecl->setAbstractType(fn);
+            }
+        }
+        break;
+    }
+    case DeferredReturn: {
+        auto fn = decl->type<FunctionType>();
+        if (!fn) {
+            return true;
+        }
+        auto returnType = functionReturnType(entry.node, entry.context, fn);
+        DUChainWriteLocker lock;
+        fn->setReturnType(returnType);
+        decl->setAbstractType(fn);
+        return !UnresolvedTypeFinder::isUnresolved(returnType);
+    }
+    case DeferredCapture:
+    case DeferredForCapture: {
+        ExpressionVisitor v(session, entry.context);
+        v.startVisiting(entry.node, entry.owner);
+        const auto exprType = v.lastType();
+        entry.problem.clear();
+        t = entry.kind == DeferredCapture
+            ? captureType(static_cast<NodeKind>(entry.arg), exprType, entry.problem)
+            : forCaptureType(exprType, entry.arg, entry.problem);
+        if (!t) {
+            if (UnresolvedTypeFinder::isUnresolved(exprType)) {
+                return false; // Reported at the end if it stays unresolved
+            }
+            // Resolved to something that cannot be captured
+            addHint(entry.range, entry.problem, entry.context->topContext());
+            return true;
+        }
+        break;
+    }
+    }
+    DUChainWriteLocker lock;
+    decl->setAbstractType(t);
+    return !UnresolvedTypeFinder::isUnresolved(t);
+}
+
+void DeclarationBuilder::addHint(const RangeInRevision &range, const QString &description, TopDUContext *top)
+{
+    ProblemPointer p = ProblemPointer(new Problem());
+    p->setFinalLocation(DocumentRange(session->document(), range.castToSimpleRange()));
+    p->setSource(IProblem::DUChainBuilder);
+    p->setSeverity(IProblem::Hint);
+    p->setDescription(description);
+    DUChainWriteLocker lock;
+    (top ? top : topContext())->addProblem(p);
+}
+
 VisitResult DeclarationBuilder::visitNode(const ZigNode &node, const ZigNode &parent)
 {
     NodeKind kind = node.kind();
@@ -157,7 +296,15 @@ VisitResult DeclarationBuilder::buildDeclaration(const ZigNode &node, const ZigN
 
     QString name = overwrite ? parent.spellingName() : node.spellingName();
     auto range = editorFindSpellingRange(overwrite ? parent : node, name);
-    createDeclaration<Kind>(node, parent, name, isDef, range);
+    auto *decl = createDeclaration<Kind>(node, parent, name, isDef, range);
+    if (m_deferring && (Kind == VarDecl || (Kind == FieldDecl && parent.kind() != EnumDecl
+            && parent.kind() != UnionDecl && node.tag() != NodeTag_error_set_decl))) {
+        DUChainReadLocker lock;
+        if (UnresolvedTypeFinder::isUnresolved(decl->abstractType())) {
+            lock.unlock();
+            defer(Kind == VarDecl ? DeferredValue : DeferredField, node, parent, decl);
+        }
+    }
     VisitResult ret = buildContext<Kind>(node, parent);
     if (hasContext) {
         eventuallyAssignInternalContext();
@@ -251,7 +398,7 @@ StructureType::Ptr DeclarationBuilder::createType(const ZigNode &node, const Zig
         if (Kind == Module) {
             structType->setModifiers(ModuleModifier);
         }
-        else if (node.mainToken() == QStringLiteral("@cImport")) {
+        else if (node.builtinId() == BuiltinFnId_cImport) {
             structType->setModifiers(ModuleModifier | CIncludeModifier);
         }
         return structType;
@@ -342,59 +489,9 @@ AbstractType::Ptr DeclarationBuilder::createType(const ZigNode &node, const ZigN
     }
     else if (Kind == FieldDecl) {
         // Struct field
-        ZigNode typeNode = node.varType();
-        ExpressionVisitor v(session, currentContext());
-        v.setExcludedDeclaration(currentDeclaration());
-        v.startVisiting(typeNode, node);
-        return v.lastType();
+        return fieldDeclType(node, currentContext(), currentDeclaration());
     } else if (Kind == VarDecl) {
-        const bool isConst = node.mainToken() == QLatin1String("const");
-        ZigNode typeNode = node.varType();
-        ZigNode valueNode = node.varValue();
-
-        // Value only
-        if (typeNode.isRoot()) {
-            ExpressionVisitor v(session, currentContext());
-            v.startVisiting(valueNode, node);
-            return v.lastType();
-        }
-
-        // Type and value
-        ExpressionVisitor typeVisitor(session, currentContext());
-        typeVisitor.startVisiting(typeNode, node);
-        auto t = typeVisitor.lastType();
-        // Skip for fields / var, that also requires tracking changes...
-        if (!isConst || valueNode.isRoot())
-            return t; // No value
-
-        // TODO: Should it skip fields?
-        // If the value is assigned try set the comptime known value
-        if (auto type = dynamic_cast<ComptimeType*>(t.data())) {
-            ExpressionVisitor v(session, currentContext());
-            v.setInferredType(t);
-            v.startVisiting(valueNode, node);
-
-            // If we have a builtin type and a comptime known value
-            // clone the type and copy the value. This is so the type
-            // info not lost. Eg `const x: u8 = 1` will keep the u8 type.
-            if (auto value = v.lastType().dynamicCast<BuiltinType>()) {
-                if (value->isComptimeKnown()) {
-                    auto comptimeType = dynamic_cast<ComptimeType*>(t->clone());
-                    Q_ASSERT(comptimeType);
-                    comptimeType->setComptimeKnownValue(value->comptimeKnownValue());
-                    return comptimeType->asType();
-                }
-            }
-            // If we have another comptime known value return the value
-            // This may be an enum field, string or something
-            // TODO: This can squash an error if the type is not correct
-            else if (auto value = dynamic_cast<ComptimeType*>(v.lastType().data())) {
-                if (value->isComptimeKnown()) {
-                    return value->asType();
-                }
-            }
-        }
-        return t; // Has a value but could be another variable/expression, etc..
+        return varDeclType(node, currentContext());
     }
     else if (Kind ==  ParamDecl) {
         // Function arg node is the type
@@ -410,6 +507,66 @@ AbstractType::Ptr DeclarationBuilder::createType(const ZigNode &node, const ZigN
     return AbstractType::Ptr(new IntegralType(IntegralType::TypeMixed));
 }
 
+AbstractType::Ptr DeclarationBuilder::fieldDeclType(const ZigNode &node, const DUContext *context, const Declaration *decl)
+{
+    ZigNode typeNode = node.varType();
+    ExpressionVisitor v(session, context);
+    v.setExcludedDeclaration(decl);
+    v.startVisiting(typeNode, node);
+    return v.lastType();
+}
+
+AbstractType::Ptr DeclarationBuilder::varDeclType(const ZigNode &node, const DUContext *context)
+{
+    const bool isConst = node.mainToken() == QLatin1String("const");
+    ZigNode typeNode = node.varType();
+    ZigNode valueNode = node.varValue();
+
+    // Value only
+    if (typeNode.isRoot()) {
+        ExpressionVisitor v(session, context);
+        v.startVisiting(valueNode, node);
+        return v.lastType();
+    }
+
+    // Type and value
+    ExpressionVisitor typeVisitor(session, context);
+    typeVisitor.startVisiting(typeNode, node);
+    auto t = typeVisitor.lastType();
+    // Skip for fields / var, that also requires tracking changes...
+    if (!isConst || valueNode.isRoot())
+        return t; // No value
+
+    // TODO: Should it skip fields?
+    // If the value is assigned try set the comptime known value
+    if (auto type = dynamic_cast<ComptimeType*>(t.data())) {
+        ExpressionVisitor v(session, context);
+        v.setInferredType(t);
+        v.startVisiting(valueNode, node);
+
+        // If we have a builtin type and a comptime known value
+        // clone the type and copy the value. This is so the type
+        // info not lost. Eg `const x: u8 = 1` will keep the u8 type.
+        if (auto value = v.lastType().dynamicCast<BuiltinType>()) {
+            if (value->isComptimeKnown()) {
+                auto comptimeType = dynamic_cast<ComptimeType*>(t->clone());
+                Q_ASSERT(comptimeType);
+                comptimeType->setComptimeKnownValue(value->comptimeKnownValue());
+                return comptimeType->asType();
+            }
+        }
+        // If we have another comptime known value return the value
+        // This may be an enum field, string or something
+        // TODO: This can squash an error if the type is not correct
+        else if (auto value = dynamic_cast<ComptimeType*>(v.lastType().data())) {
+            if (value->isComptimeKnown()) {
+                return value->asType();
+            }
+        }
+    }
+    return t; // Has a value but could be another variable/expression, etc..
+}
+
 template <NodeKind Kind>
 void DeclarationBuilder::setType(Declaration *decl, typename IdType<Kind>::Type *type)
 {
@@ -495,9 +652,9 @@ void DeclarationBuilder::updateFunctionArgs(const ZigNode &node, const ZigNode &
     auto *decl = currentDeclaration();
     auto fn = decl->type<FunctionType>();
     Q_ASSERT(fn);
-    const auto n = node.fnParamCount();
-    for (uint32_t i=0; i < n; i++) {
-        auto paramData = node.fnParamData(i);
+    const auto params = node.fnParams();
+    for (int i=0; i < params.size(); i++) {
+        const auto &paramData = params.at(i);
         ZigNode paramType = {node.ast, paramData.type_expr};
         QString paramName = node.tokenSlice(paramData.name_token);
         auto paramRange = node.tokenRange(paramData.name_token);
@@ -536,6 +693,10 @@ void DeclarationBuilder::updateFunctionArgs(const ZigNode &node, const ZigNode &
             else if (paramData.info.is_anytype) {
                 param->setAbstractType(BuiltinType::newFromName(QStringLiteral("anytype")));
             }
+            else if (m_deferring && !paramData.info.is_vararg
+                    && UnresolvedTypeFinder::isUnresolved(param->abstractType())) {
+                defer(DeferredParam, paramType, node, param, i);
+            }
 
             fn->addArgument(param->abstractType(), i);
         }
@@ -554,13 +715,24 @@ void DeclarationBuilder::updateFunctionArgs(const ZigNode &node, const ZigNode &
 
 void DeclarationBuilder::updateFunctionReturnType(const ZigNode &node, const ZigNode &parent)
 {
-    Q_UNUSED(parent);
     Q_ASSERT(hasCurrentDeclaration());
     auto *decl = currentDeclaration();
     auto fn = decl->type<FunctionType>();
+    auto returnType = functionReturnType(node, currentContext(), fn);
+    if (m_deferring && UnresolvedTypeFinder::isUnresolved(returnType)) {
+        defer(DeferredReturn, node, parent, decl);
+    }
+    DUChainWriteLocker lock;
+    fn->setReturnType(returnType);
+    decl->setAbstractType(fn);
+    // qCDebug(KDEV_ZIG)  << "  fn type" << fn->toString();
+}
+
+AbstractType::Ptr DeclarationBuilder::functionReturnType(const ZigNode &node, const DUContext *context, const FunctionType::Ptr &fn)
+{
     ZigNode typeNode = node.returnType();
     Q_ASSERT(!typeNode.isRoot());
-    ExpressionVisitor v(session, currentContext());
+    ExpressionVisitor v(session, context);
     v.startVisiting(typeNode, node);
     // Zig does not use error_union for inferred return types...
     auto returnType = v.lastType();
@@ -568,7 +740,7 @@ void DeclarationBuilder::updateFunctionReturnType(const ZigNode &node, const Zig
     if (auto builtin = returnType.dynamicCast<BuiltinType>()) {
         if (builtin->isType() && node.tag() == NodeTag_fn_decl) {
             // DUChainWriteLocker lock;
-            FunctionVisitor f(session, currentContext());
+            FunctionVisitor f(session, context);
             NodeData data = node.data();
             ZigNode bodyNode = {node.ast, data.rhs};
             f.setCurrentFunction(fn);
@@ -589,10 +761,7 @@ void DeclarationBuilder::updateFunctionReturnType(const ZigNode &node, const Zig
         // TODO: Should it set type to anyerror?
         returnType = errType;
     }
-    DUChainWriteLocker lock;
-    fn->setReturnType(returnType);
-    decl->setAbstractType(fn);
-    // qCDebug(KDEV_ZIG)  << "  fn type" << fn->toString();
+    return returnType;
 }
 
 template <NodeKind Kind, EnableIf<NodeTraits::canHaveCapture(Kind)>>
@@ -607,43 +776,22 @@ void DeclarationBuilder::maybeBuildCapture(const ZigNode &node, const ZigNode &p
         QString name = node.tokenSlice(nameToken);
         auto range = node.tokenRange(nameToken);
         auto decl = createDeclaration<VarDecl>(node, parent, name, true, range);
-        if (Kind == If || Kind == While) {
-            // If and While captures unwrap the optional type
-            ZigNode optionalType = node.lhsAsNode();
+        if (Kind == If || Kind == While || Kind == Catch) {
+            // If and While captures unwrap the optional type, catch the error
+            ZigNode exprNode = node.lhsAsNode();
             ExpressionVisitor v(session, currentContext());
-            v.startVisiting(optionalType, node);
-            if (auto opt = v.lastType().dynamicCast<OptionalType>()) {
-                DUChainWriteLocker lock;
-                decl->setAbstractType(opt->baseType());
-            }
-            else if (!m_prebuilding) {
-                // Type is known but not an optional type, this is a problem
-                ProblemPointer p = ProblemPointer(new Problem());
-                p->setFinalLocation(DocumentRange(session->document(), range.castToSimpleRange()));
-                p->setSource(IProblem::SemanticAnalysis);
-                p->setSeverity(IProblem::Hint);
-                p->setDescription(i18n("Attempt to unwrap non-optional type"));
+            v.startVisiting(exprNode, node);
+            QString problem;
+            if (auto t = captureType(Kind, v.lastType(), problem)) {
                 DUChainWriteLocker lock;
-                topContext()->addProblem(p);
+                decl->setAbstractType(t);
             }
-        }
-        else if (Kind == Catch) {
-            ZigNode errorType = node.lhsAsNode();
-            ExpressionVisitor v(session, currentContext());
-            v.startVisiting(errorType, node);
-            if (auto err = v.lastType().dynamicCast<ErrorType>()) {
-                DUChainWriteLocker lock;
-                decl->setAbstractType(err->errorType());
+            else if (m_deferring && UnresolvedTypeFinder::isUnresolved(v.lastType())) {
+                defer(DeferredCapture, exprNode, node, decl, Kind, range);
             }
             else if (!m_prebuilding) {
-                // Type is known but not an optional type, this is a problem
-                ProblemPointer p = ProblemPointer(new Problem());
-                p->setFinalLocation(DocumentRange(session->document(), range.castToSimpleRange()));
-                p->setSource(IProblem::SemanticAnalysis);
-                p->setSeverity(IProblem::Hint);
-                p->setDescription(i18n("Attempt to catch non-error type"));
-                DUChainWriteLocker lock;
-                topContext()->addProblem(p);
+                // Type is known but cannot be captured, this is a problem
+                addHint(range, problem);
             }
         }
         closeDeclaration();
@@ -659,8 +807,8 @@ void DeclarationBuilder::buildForCapture(const ZigNode &node, const ZigNode &par
     // tok would be the position of *
     TokenIndex tok = ast_node_capture_token(node.ast, node.index, CaptureType::Payload);
 
-    const auto n = node.forInputCount();
-    for (uint32_t i=0; i < n; i++) {
+    const auto inputs = node.forInputs();
+    for (const ZigNode &forInputNode : inputs) {
         // qCDebug(KDEV_ZIG) << "Create for loop capture "<< (isPtr ? "*" + name: name);
         const QString captureName = node.tokenSlice(tok);
         const bool isPtr = captureName == QLatin1String("*");
@@ -670,62 +818,20 @@ void DeclarationBuilder::buildForCapture(const ZigNode &node, const ZigNode &par
         Q_ASSERT(name != QLatin1String(","));
         auto range = node.tokenRange(nameToken);
 
-        const ZigNode forInputNode = node.forInputAt(i);
         auto decl = createDeclaration<VarDecl>(forInputNode, node, name, true, range);
         ExpressionVisitor v(session, currentContext());
         v.startVisiting(forInputNode, node);
-        if (auto arrayPtr = v.lastType().dynamicCast<Zig::PointerType>()) {
-            // qCDebug(KDEV_ZIG) << "loop type is pointer";
-            if (auto slice = arrayPtr->baseType().dynamicCast<SliceType>()) {
-                DUChainWriteLocker lock;
-                if (isPtr) {
-                    auto ptr = new Zig::PointerType();
-                    Q_ASSERT(ptr);
-                    ptr->setBaseType(slice->elementType());
-                    decl->setAbstractType(AbstractType::Ptr(ptr));
-                } else {
-                    decl->setAbstractType(slice->elementType());
-                }
-            }
-            else if (!m_prebuilding) {
-                // Type is known but not an optional type, this is a problem
-                ProblemPointer p = ProblemPointer(new Problem());
-                p->setFinalLocation(DocumentRange(session->document(), range.castToSimpleRange()));
-                p->setSource(IProblem::SemanticAnalysis);
-                p->setSeverity(IProblem::Hint);
-                p->setDescription(i18n("Attempt to loop pointer of non-array type"));
-                DUChainWriteLocker lock;
-                topContext()->addProblem(p);
-            }
-        }
-        else if (auto slice = v.lastType().dynamicCast<SliceType>()) {
-            // qCDebug(KDEV_ZIG) << "loop type is slice";
+        QString problem;
+        if (auto t = forCaptureType(v.lastType(), isPtr, problem)) {
             DUChainWriteLocker lock;
-            if (isPtr) {
-                auto ptr = new Zig::PointerType();
-                ptr->setBaseType(slice->elementType());
-                decl->setAbstractType(AbstractType::Ptr(ptr));
-            } else {
-                decl->setAbstractType(slice->elementType());
-            }
+            decl->setAbstractType(t);
+        }
+        else if (m_deferring && UnresolvedTypeFinder::isUnresolved(v.lastType())) {
+            defer(DeferredForCapture, forInputNode, node, decl, isPtr, range);
         }
         else if (!m_prebuilding) {
-            // Type is known but not an optional type, this is a problem
-            // {
-            //     DUChainReadLocker lock;
-            //     qCDebug(KDEV_ZIG) << "for loop type is invalid " << v.lastType()->toString();
-            // }
-            ProblemPointer p = ProblemPointer(new Problem());
-            p->setFinalLocation(DocumentRange(session->document(), range.castToSimpleRange()));
-            p->setSource(IProblem::SemanticAnalysis);
-            p->setSeverity(IProblem::Hint);
-            if (isPtr) {
-                p->setDescription(i18n("Attempt to capture pointer on non-pointer type"));
-            } else {
-                p->setDescription(i18n("Attempt to loop non-array type"));
-            }
-            DUChainWriteLocker lock;
-            topContext()->addProblem(p);
+            // Type is known but cannot be looped, this is a problem
+            addHint(range, problem);
         } else {
             qCDebug(KDEV_ZIG) << "for loop type is unknown";
         }
@@ -733,6 +839,46 @@ void DeclarationBuilder::buildForCapture(const ZigNode &node, const ZigNode &par
     }
 }
 
+AbstractType::Ptr DeclarationBuilder::captureType(NodeKind kind, const AbstractType::Ptr &exprType, QString &problem)
+{
+    if (kind == Catch) {
+        if (auto err = exprType.dynamicCast<ErrorType>()) {
+            return err->errorType();
+        }
+        problem = i18n("Attempt to catch non-error type");
+        return AbstractType::Ptr();
+    }
+    if (auto opt = exprType.dynamicCast<OptionalType>()) {
+        return opt->baseType();
+    }
+    problem = i18n("Attempt to unwrap non-optional type");
+    return AbstractType::Ptr();
+}
+
+AbstractType::Ptr DeclarationBuilder::forCaptureType(const AbstractType::Ptr &iterType, bool isPtr, QString &problem)
+{
+    SliceType::Ptr slice;
+    if (auto arrayPtr = iterType.dynamicCast<Zig::PointerType>()) {
+        // qCDebug(KDEV_ZIG) << "loop type is pointer";
+        slice = arrayPtr->baseType().dynamicCast<SliceType>();
+        if (!slice) {
+            problem = i18n("Attempt to loop pointer of non-array type");
+            return AbstractType::Ptr();
+        }
+    }
+    else if (!(slice = iterType.dynamicCast<SliceType>())) {
+        problem = isPtr ? i18n("Attempt to capture pointer on non-pointer type")
+                        : i18n("Attempt to loop non-array type");
+        return AbstractType::Ptr();
+    }
+    if (isPtr) {
+        Zig::PointerType::Ptr ptr(new Zig::PointerType());
+        ptr->setBaseType(slice->elementType());
+        return ptr;
+    }
+    return slice->elementType();
+}
+
 void DeclarationBuilder::buildErrorDecl(const ZigNode &node, const ZigNode &parent)
 {
     TokenIndex start_tok = ast_node_main_token(node.ast, node.index) + 2;
@@ -775,7 +921,7 @@ void DeclarationBuilder::visitCall(const ZigNode &node, const ZigNode &parent)
 {
     if (node.isBuiltinCallTwo()
         && parent.kind() == VarDecl
-        && node.mainToken() == QStringLiteral("@cImport"))
+        && node.builtinId() == BuiltinFnId_cImport)
     {
         createCImportDeclaration(node, parent);
     }
@@ -839,7 +985,7 @@ void DeclarationBuilder::visitCall(const ZigNode &node, const ZigNode &parent)
 Declaration* DeclarationBuilder::createCImportDeclaration(const ZigNode &node, const ZigNode &parent)
 {
     Q_ASSERT(node.isBuiltinCallTwo());
-    Q_ASSERT(node.mainToken() == QStringLiteral("@cImport"));
+    Q_ASSERT(node.builtinId() == BuiltinFnId_cImport);
     QString name = parent.tag() == NodeTag_usingnamespace ? parent.containerName() : parent.spellingName();
     auto range = parent.spellingRange();
     auto decl = createDeclaration<ContainerDecl>(node, parent, name, true, range);
@@ -864,13 +1010,14 @@ void DeclarationBuilder::visitUsingnamespace(const ZigNode &node, const ZigNode
     // HACK: The ExpressionVisitor for callBuiltinCImport has no
     // owner declaration so the internal context is never imported
     ExpressionVisitor v(session, currentContext());
-    if (lhs.isBuiltinCallTwo() && lhs.mainToken() == QStringLiteral("@cImport")) {
+    if (lhs.isBuiltinCallTwo() && lhs.builtinId() == BuiltinFnId_cImport) {
         Q_ASSERT(currentContext()->owner());
         v.setInferredType(currentContext()->owner()->abstractType());
     }
     v.startVisiting(lhs, node);
+    T = Helper::resolveDelayedImport(v.lastType());
 
-    if (auto s = v.lastType().dynamicCast<StructureType>()) {
+    if (auto s = T.dynamicCast<StructureType>()) {
         DUChainWriteLocker lock;
         const auto isModule = s->modifiers() & ModuleModifier;
         const auto moduleContext = (isModule && s->declaration(nullptr)) ? s->declaration(nullptr)->topContext() : topContext();
@@ -883,16 +1030,21 @@ void DeclarationBuilder::visitUsingnamespace(const ZigNode &node, const ZigNode
         }
     }
 
+    // Every member of the namespace is accessible so it is needed now
+    const IndexedString module = Helper::delayedImportFile(T);
+    if (!module.isEmpty()) {
+        ImportScheduler::self().demandImport(session->document(), module, session->jobPriority());
+        session->addUnresolvedImport(module);
+    }
+
+    if (m_deferring) {
+        // Everything after may be found through it so resolving this
+        // later is not enough
+        m_needsSecondPass = true;
+    }
     // Type is known but not an optional type, this is a problem
-    if (!m_prebuilding) {
-        ProblemPointer p = ProblemPointer(new Problem());
-        auto range = node.mainTokenRange();
-        p->setFinalLocation(DocumentRange(session->document(), range.castToSimpleRange()));
-        p->setSource(IProblem::SemanticAnalysis);
-        p->setSeverity(IProblem::Hint);
-        p->setDescription(i18n("Namespace unknown or not yet resolved"));
-        DUChainWriteLocker lock;
-        topContext()->addProblem(p);
+    else if (!m_prebuilding) {
+        addHint(node.mainTokenRange(), i18n("Namespace unknown or not yet resolved"));
     }
     return;
 
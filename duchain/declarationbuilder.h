@@ -20,6 +20,7 @@
 
 #include <type_traits>
 #include <QString>
+#include <QVector>
 
 #include <language/duchain/builders/abstracttypebuilder.h>
 #include <language/duchain/builders/abstractdeclarationbuilder.h>
@@ -63,12 +64,73 @@ public:
      */
     void setPrebuilding(bool prebuilding) {m_prebuilding = prebuilding;}
 
+    /**
+     * @brief Set whether declarations are built in a single pass.
+     * Types that refer to declarations further down are resolved once
+     * the pass is done. When false a full prebuild pass runs first.
+     */
+    void setSinglePass(bool singlePass) {m_singlePass = singlePass;}
+
     VisitResult visitNode(const ZigNode &node, const ZigNode &parent) override;
     virtual void visitChildren(const ZigNode &node, const ZigNode &parent) override;
 
 protected:
     // true if the first of the two performed passes is currently active
     bool m_prebuilding = false;
+    bool m_singlePass = true;
+    // true while unresolved types are recorded instead of reported
+    bool m_deferring = false;
+    // An unresolved namespace changes the lookup of everything after it
+    bool m_needsSecondPass = false;
+
+    enum DeferredKind {
+        DeferredValue,
+        DeferredField,
+        DeferredParam,
+        DeferredReturn,
+        DeferredCapture,
+        DeferredForCapture,
+    };
+
+    // A declaration whose type was not resolved when it was built,
+    // eg it refers to a declaration further down the container
+    struct DeferredDecl
+    {
+        DeferredKind kind;
+        // The expression to evaluate and the node it belongs to
+        ZigNode node;
+        ZigNode owner;
+        KDevelop::DUContext *context;
+        KDevelop::DeclarationPointer decl;
+        // Param index, capture node kind or for capture is pointer
+        int arg;
+        KDevelop::RangeInRevision range;
+        // Reported if it is still unresolved at the end
+        QString problem;
+    };
+    QVector<DeferredDecl> m_deferred;
+
+    void defer(DeferredKind kind, const ZigNode &node, const ZigNode &owner,
+               KDevelop::Declaration *decl, int arg = 0,
+               const KDevelop::RangeInRevision &range = KDevelop::RangeInRevision::invalid());
+    // Resolve deferred declarations until nothing changes
+    void resolveDeferred();
+    // Returns true if the type is resolved
+    bool resolveDeferredDecl(DeferredDecl &entry);
+
+    KDevelop::AbstractType::Ptr varDeclType(const ZigNode &node, const KDevelop::DUContext *context);
+    KDevelop::AbstractType::Ptr fieldDeclType(const ZigNode &node, const KDevelop::DUContext *context,
+                                              const KDevelop::Declaration *decl);
+    KDevelop::AbstractType::Ptr functionReturnType(const ZigNode &node, const KDevelop::DUContext *context,
+                                                   const KDevelop::FunctionType::Ptr &fn);
+    // Type of an if/while/catch capture or null with the reason in problem
+    KDevelop::AbstractType::Ptr captureType(NodeKind kind, const KDevelop::AbstractType::Ptr &exprType,
+                                            QString &problem);
+    // Element type of a for capture or null with the reason in problem
+    KDevelop::AbstractType::Ptr forCaptureType(const KDevelop::AbstractType::Ptr &iterType, bool isPtr,
+                                               QString &problem);
+    void addHint(const KDevelop::RangeInRevision &range, const QString &description,
+                 KDevelop::TopDUContext *top = nullptr);
 
     template <NodeKind Kind>
     VisitResult buildDeclaration(const ZigNode &node, const ZigNode &parent);
@@ -1,5 +1,6 @@
 #pragma once
 #include <language/duchain/types/typesystem.h>
+#include <language/duchain/types/integraltype.h>
 #include "types/delayedtype.h"
 #include "kdevzigduchain_export.h"
 
@@ -28,5 +29,35 @@ public:
     QList<DelayedType::Ptr> delayedTypes;
 };
 
+/**
+ * Find if a type refers to something that was not found, the expression
+ * visitor encounters mixed for any name it cannot look up
+ */
+class KDEVZIGDUCHAIN_EXPORT UnresolvedTypeFinder : public KDevelop::SimpleTypeVisitor
+{
+public:
+    ~UnresolvedTypeFinder() = default;
+
+    bool visit(const KDevelop::AbstractType* t) override {
+        if (auto it = dynamic_cast<const KDevelop::IntegralType*>(t)) {
+            if (it->dataType() == KDevelop::IntegralType::TypeMixed) {
+                unresolved = true;
+            }
+        }
+        return !unresolved;
+    }
+
+    static bool isUnresolved(const KDevelop::AbstractType::Ptr &t) {
+        if (!t) {
+            return true;
+        }
+        UnresolvedTypeFinder finder;
+        t->accept(&finder);
+        return finder.unresolved;
+    }
+
+    bool unresolved = false;
+};
+
 
 } // end namespace
@@ -21,6 +21,7 @@
 #include "expressionvisitor.h"
 
 #include "helpers.h"
+#include "importscheduler.h"
 #include "zigdebug.h"
 #include "nodetraits.h"
 
@@ -28,16 +29,6 @@
 namespace Zig
 {
 
-static VisitResult expressionVisitorCallback(ZAst* ast, NodeIndex node, NodeIndex parent, void *data)
-{
-    ExpressionVisitor *visitor = static_cast<ExpressionVisitor *>(data);
-    Q_ASSERT(visitor);
-    ZigNode childNode = {ast, node};
-    ZigNode parentNode = {ast, parent};
-    return visitor->visitNode(childNode, parentNode);
-}
-
-
 ExpressionVisitor::ExpressionVisitor(ParseSession* session, const KDevelop::DUContext* context)
     : DynamicLanguageExpressionVisitor(context)
     , m_session(session)
@@ -61,7 +52,7 @@ ExpressionVisitor::ExpressionVisitor(ExpressionVisitor* parent, const KDevelop::
 void ExpressionVisitor::visitChildren(const ZigNode &node, const ZigNode &parent)
 {
     Q_UNUSED(parent);
-    ast_visit(node.ast, node.index, expressionVisitorCallback, this);
+    visitChildNodes(this, node);
 }
 
 void ExpressionVisitor::startVisiting(const ZigNode &node, const ZigNode &parent)
@@ -69,15 +60,27 @@ void ExpressionVisitor::startVisiting(const ZigNode &node, const ZigNode &parent
     if (node.isRoot()) {
         return;
     }
-    // if (auto cachedType = session()->typeFromNode(node)) {
-    //     if (auto cachedDecl = session()->declFromNode(node)) {
-    //         encounterLvalue(DeclarationPointer(cachedDecl));
-    //     } else {
-    //         encounter(cachedType);
-    //     }
-    //     return;
-    // }
+    // The inferred type, excluded decl and current function change the
+    // result so only plain visitors use the memo
+    const bool memoize = !m_inferredType && !m_excludedDeclaration && !m_currentFunction;
+    if (memoize) {
+        CachedExpression cached;
+        if (session()->cachedExpression(node, context(), cached)) {
+            encounter(cached.type, cached.decl);
+            return;
+        }
+    }
     visitNode(node, parent);
+    const auto type = lastType();
+    // A name that is not found yet may be declared later in the same pass
+    if (memoize && !UnresolvedTypeFinder::isUnresolved(type) && !m_returnType && !m_breakType) {
+        // A delayed type is resolved differently at each call site
+        DelayedTypeFinder finder;
+        type->accept(&finder);
+        if (finder.delayedTypes.isEmpty()) {
+            session()->setCachedExpression(node, context(), type, lastDeclaration());
+        }
+    }
 }
 
 VisitResult ExpressionVisitor::visitNode(const ZigNode &node, const ZigNode &parent)
@@ -551,14 +554,15 @@ VisitResult ExpressionVisitor::visitEnumLiteral(const ZigNode &node, const ZigNo
 VisitResult ExpressionVisitor::visitIdentifier(const ZigNode &node, const ZigNode &parent)
 {
     Q_UNUSED(parent);
-    QString name = node.mainToken();
+    const CachedIdentifier &ident = session()->identifier(node, node.mainTokenIndex());
+    const QString name = ident.isValid() ? ident.name : node.mainToken();
     // qCDebug(KDEV_ZIG) << "visit ident" << name;
     if (auto builtinType = BuiltinType::newFromName(name)) {
         encounter(builtinType);
     }
     else if (
         auto* decl = Helper::declarationForName(
-            name,
+            ident.isValid() ? ident.identifier : KDevelop::IndexedIdentifier(KDevelop::Identifier(name)),
             CursorInRevision::invalid(),
             DUChainPointer<const DUContext>(context()),
             m_excludedDeclaration
@@ -611,7 +615,8 @@ VisitResult ExpressionVisitor::visitFieldAccess(const ZigNode &node, const ZigNo
     NodeData data = node.data();
     ZigNode owner = {node.ast, data.lhs};
     v.startVisiting(owner, node);
-    QString attr = node.tokenSlice(data.rhs);
+    const CachedIdentifier &ident = session()->identifier(node, data.rhs);
+    const QString attr = ident.isValid() ? ident.name : node.tokenSlice(data.rhs);
     const auto T = v.lastType();
     // {
     //     DUChainReadLocker lock; // Needed if printing debug statement
@@ -634,13 +639,20 @@ VisitResult ExpressionVisitor::visitFieldAccess(const ZigNode &node, const ZigNo
         return Continue;
     }
 
-    if (auto *decl = Helper::accessAttribute(T, attr, topContext())) {
+    const KDevelop::IndexedIdentifier attrId = ident.isValid() ? ident.identifier : KDevelop::IndexedIdentifier(KDevelop::Identifier(attr));
+    if (auto *decl = Helper::accessAttribute(T, attrId, topContext())) {
         // DUChainReadLocker lock; // Needed if printing debug statement
         //qCDebug(KDEV_ZIG) << " result " << decl->toString() << "from" << decl->url();
         encounterLvalue(DeclarationPointer(decl));
     }
     else {
         // qCDebug(KDEV_ZIG) << " no result ";
+        // A member of a module that is not parsed yet is needed now
+        const IndexedString module = Helper::delayedImportFile(Helper::resolveDelayedImport(T));
+        if (!module.isEmpty()) {
+            ImportScheduler::self().demandImport(session()->document(), module, session()->jobPriority());
+            m_session->addUnresolvedImport(module);
+        }
         encounterUnknown();
     }
     return Continue;
@@ -725,81 +737,76 @@ VisitResult ExpressionVisitor::visitContainerDecl(const ZigNode &node, const Zig
 VisitResult ExpressionVisitor::visitBuiltinCall(const ZigNode &node, const ZigNode &parent)
 {
     Q_UNUSED(parent);
-    QString name = node.mainToken();
-    if (name == QLatin1String("@as")) {
+    switch (node.builtinId()) {
+    case BuiltinFnId_as:
         return callBuiltinAs(node);
-    } else if (name == QLatin1String("@This")) {
+    case BuiltinFnId_This:
         return callBuiltinThis(node);
-    } else if (name == QLatin1String("@import")) {
+    case BuiltinFnId_import:
         return callBuiltinImport(node);
-    } else if (name == QLatin1String("@cImport")) {
+    case BuiltinFnId_cImport:
         return callBuiltinCImport(node);
-    } else if (name == QLatin1String("@cInclude")) {
+    case BuiltinFnId_cInclude:
         return callBuiltinCInclude(node);
-    } else if (name == QLatin1String("@typeInfo")) {
+    case BuiltinFnId_typeInfo:
         return callBuiltinTypeInfo(node);
-    } else if (name == QLatin1String("@TypeOf")) {
+    case BuiltinFnId_TypeOf:
         return callBuiltinTypeOf(node);
-    } else if (name == QLatin1String("@fieldParentPtr")) {
+    case BuiltinFnId_fieldParentPtr:
         return callBuiltinFieldParentPtr(node);
-    } else if (name == QLatin1String("@field")) {
+    case BuiltinFnId_field:
         return callBuiltinField(node);
-    } else if (name == QLatin1String("@intFromFloat")) {
+    case BuiltinFnId_intFromFloat:
         return callBuiltinIntFromFloat(node);
-    } else if (name == QLatin1String("@floatFromInt")) {
+    case BuiltinFnId_floatFromInt:
         return callBuiltinFloatFromInt(node);
-    } else if (name == QLatin1String("@intFromBool")) {
+    case BuiltinFnId_intFromBool:
         return callBuiltinIntFromBool(node);
-    } else if (name == QLatin1String("@boolFromInt")) {
-        return callBuiltinBoolFromInt(node);
-    } else if (name == QLatin1String("@intCast")) {
+    case BuiltinFnId_intCast:
         return callBuiltinIntCast(node);
-    } else if (name == QLatin1String("@enumFromInt")) {
+    case BuiltinFnId_enumFromInt:
         return callBuiltinEnumFromInt(node);
-    } else if (name == QLatin1String("@intFromEnum")) {
+    case BuiltinFnId_intFromEnum:
         return callBuiltinIntFromEnum(node);
-    } else if (name == QLatin1String("@Vector")) {
+    case BuiltinFnId_Vector:
         return callBuiltinVector(node);
-    } else if (name == QLatin1String("@reduce")) {
+    case BuiltinFnId_reduce:
         return callBuiltinReduce(node);
-    } else if (name == QLatin1String("@splat")) {
+    case BuiltinFnId_splat:
         return callBuiltinSplat(node);
     // todo @Type
-    // todo @Type
-    } else if (
-        // These return the type of the first argument
-        name == QLatin1String("@sqrt")
-        || name == QLatin1String("@sin")
-        || name == QLatin1String("@cos")
-        || name == QLatin1String("@tan")
-        || name == QLatin1String("@exp")
-        || name == QLatin1String("@exp2")
-        || name == QLatin1String("@log")
-        || name == QLatin1String("@log2")
-        || name == QLatin1String("@log10")
-        || name == QLatin1String("@floor")
-        || name == QLatin1String("@ceil")
-        || name == QLatin1String("@trunc")
-        || name == QLatin1String("@round")
-        || name == QLatin1String("@min")
-        || name == QLatin1String("@max")
-        || name == QLatin1String("@mod")
-        || name == QLatin1String("@rem")
-        || name == QLatin1String("@abs")
-        || name == QLatin1String("@shlExact")
-        || name == QLatin1String("@shrExact")
-        || name == QLatin1String("@mulAdd")
-        || name == QLatin1String("@atomicLoad")
-    ) {
+    // These return the type of the first argument
+    case BuiltinFnId_sqrt:
+    case BuiltinFnId_sin:
+    case BuiltinFnId_cos:
+    case BuiltinFnId_tan:
+    case BuiltinFnId_exp:
+    case BuiltinFnId_exp2:
+    case BuiltinFnId_log:
+    case BuiltinFnId_log2:
+    case BuiltinFnId_log10:
+    case BuiltinFnId_floor:
+    case BuiltinFnId_ceil:
+    case BuiltinFnId_trunc:
+    case BuiltinFnId_round:
+    case BuiltinFnId_min:
+    case BuiltinFnId_max:
+    case BuiltinFnId_mod:
+    case BuiltinFnId_rem:
+    case BuiltinFnId_abs:
+    case BuiltinFnId_shlExact:
+    case BuiltinFnId_shrExact:
+    case BuiltinFnId_mulAdd:
+    case BuiltinFnId_atomicLoad: {
         ExpressionVisitor v(this);
         v.startVisiting(node.nextChild(), node);
         encounter(v.lastType());
-    } else if (
-        name == QLatin1String("@errorName")
-        || name == QLatin1String("@tagName")
-        || name == QLatin1String("@typeName")
-        || name == QLatin1String("@embedFile")
-    ) {
+        break;
+    }
+    case BuiltinFnId_errorName:
+    case BuiltinFnId_tagName:
+    case BuiltinFnId_typeName:
+    case BuiltinFnId_embedFile: {
         auto slice = new SliceType();
         slice->setSentinel(0);
         // Must clone since constness is modified here
@@ -807,44 +814,43 @@ VisitResult ExpressionVisitor::visitBuiltinCall(const ZigNode &node, const ZigNo
         elemType->setModifiers(AbstractType::ConstModifier);
         slice->setElementType(AbstractType::Ptr(elemType));
         encounter(AbstractType::Ptr(slice));
-    } else if (
-        name == QLatin1String("@intFromPtr")
-        || name == QLatin1String("@returnAddress")
-    ) {
+        break;
+    }
+    case BuiltinFnId_intFromPtr:
+    case BuiltinFnId_returnAddress:
         encounter(BuiltinType::newFromName(QStringLiteral("usize")));
-    } else if (
-        name == QLatin1String("@memcpy")
-        || name == QLatin1String("@memset")
-        || name == QLatin1String("@setCold")
-        || name == QLatin1String("@setAlignStack")
-        || name == QLatin1String("@setEvalBranchQuota")
-        || name == QLatin1String("@setFloatMode")
-        || name == QLatin1String("@setRuntimeSafety")
-    ) {
+        break;
+    case BuiltinFnId_memcpy:
+    case BuiltinFnId_memset:
+    case BuiltinFnId_setCold:
+    case BuiltinFnId_setAlignStack:
+    case BuiltinFnId_setEvalBranchQuota:
+    case BuiltinFnId_setFloatMode:
+    case BuiltinFnId_setRuntimeSafety:
         encounter(BuiltinType::newFromName(QStringLiteral("void")));
-    } else if (
-        name == QLatin1String("@alignOf")
-        || name == QLatin1String("@sizeOf")
-        || name == QLatin1String("@bitOffsetOf")
-        || name == QLatin1String("@bitSizeOf")
-        || name == QLatin1String("@offsetOf")
-    ) {
+        break;
+    case BuiltinFnId_alignOf:
+    case BuiltinFnId_sizeOf:
+    case BuiltinFnId_bitOffsetOf:
+    case BuiltinFnId_bitSizeOf:
+    case BuiltinFnId_offsetOf:
         encounter(BuiltinType::newFromName(QStringLiteral("comptime_int")));
-    } else if (
-        name == QLatin1String("@hasField")
-        || name == QLatin1String("@hasDecl")
-    ) {
+        break;
+    case BuiltinFnId_hasField:
+    case BuiltinFnId_hasDecl:
         encounter(BuiltinType::newFromName(QStringLiteral("bool")));
-    } else if (name == QLatin1String("@trap")) {
+        break;
+    case BuiltinFnId_trap:
         encounter(BuiltinType::newFromName(QStringLiteral("noreturn")));
-    } else if (
-        name == QLatin1String("@panic")
-        || name == QLatin1String("@compileError")
-        || name == QLatin1String("@compileLog")
-    ) {
+        break;
+    case BuiltinFnId_panic:
+    case BuiltinFnId_compileError:
+    case BuiltinFnId_compileLog:
         encounter(BuiltinType::newFromName(QStringLiteral("trap")));
-    } else {
+        break;
+    default:
         encounterUnknown();
+        break;
     }
     return Continue;
 }
@@ -906,35 +912,6 @@ VisitResult ExpressionVisitor::callBuiltinIntFromBool(const ZigNode &node)
     return Continue;
 }
 
-VisitResult ExpressionVisitor::callBuiltinBoolFromInt(const ZigNode &node)
-{
-    if (node.isBuiltinCallTwo()) {
-        ExpressionVisitor v(this);
-        v.startVisiting(node.lhsAsNode(), node);
-        const auto value = v.lastType().dynamicCast<BuiltinType>();
-        if (value && value->isInteger()) {
-            if (value->isComptimeKnown()) {
-                bool ok;
-                bool val = false;
-                QString s = value->comptimeKnownValue().str();
-                if (value->isSigned()) {
-                    val = s.toLongLong(&ok, 0);
-                } else {
-                    val = s.toULongLong(&ok, 0);
-                }
-                if (ok) {
-                    encounter(BuiltinType::newFromName( val ? QStringLiteral("true") : QStringLiteral("false")));
-                    return Continue;
-                }
-            }
-        }
-        encounter(BuiltinType::newFromName(QStringLiteral("bool")));
-        return Continue;
-    }
-    encounterUnknown();
-    return Continue;
-}
-
 VisitResult ExpressionVisitor::callBuiltinIntCast(const ZigNode &node)
 {
     const auto result = inferredType().dynamicCast<BuiltinType>();
@@ -997,9 +974,23 @@ VisitResult ExpressionVisitor::callBuiltinIntFromEnum(const ZigNode &node)
 VisitResult ExpressionVisitor::callBuiltinThis(const ZigNode &node)
 {
     // TODO: Report problem if arguments ?
-    auto range = node.range();
     DUChainReadLocker lock;
-    if (auto thisCtx = Helper::thisContext(range.start, topContext())) {
+    DUContext* thisCtx = nullptr;
+    if (m_session && node.ast == m_session->ast()) {
+        // The closest enclosing container, its context is opened before
+        // anything inside of it is visited
+        for (ZigNode parent = node.parent(); !parent.isRoot(); parent = parent.parent()) {
+            const NodeKind kind = parent.kind();
+            if (kind == ContainerDecl || kind == EnumDecl || kind == UnionDecl) {
+                thisCtx = m_session->contextFromNode(parent);
+                break;
+            }
+        }
+    }
+    if (!thisCtx) {
+        thisCtx = Helper::thisContext(node.range().start, topContext());
+    }
+    if (thisCtx) {
         if (auto owner = thisCtx->owner()) {
             encounterLvalue(DeclarationPointer(owner));
             return Continue;
@@ -1024,7 +1015,7 @@ VisitResult ExpressionVisitor::callBuiltinTypeOf(const ZigNode &node)
 VisitResult ExpressionVisitor::callBuiltinTypeInfo(const ZigNode &node)
 {
     auto decl = Helper::declarationForImportedModuleName(
-        QStringLiteral("std.builtin.Type"), session()->document().str());
+        QStringLiteral("std.builtin.Type"), session()->document().str(), session()->jobPriority());
     if (decl) {
         auto Type = decl->abstractType().dynamicCast<UnionType>();
         if (node.isBuiltinCallTwo() && Type) {
@@ -1123,8 +1114,11 @@ VisitResult ExpressionVisitor::callBuiltinImport(const ZigNode &node)
         qCDebug(KDEV_ZIG) << "Module has no declarations" << importPath.toString();
     } else {
         IndexedString dependency(importPath);
-        Helper::scheduleDependency(dependency, session()->jobPriority());
-        m_session->addUnresolvedImport(dependency);
+        // When lazy it is parsed once a member is accessed through it
+        if (ImportScheduler::self().mode() == ImportScheduler::EagerImports) {
+            Helper::scheduleDependency(dependency, session()->jobPriority());
+            m_session->addUnresolvedImport(dependency);
+        }
         // TODO: This does not work...
         // auto dep = new ScheduleDependency(
         //     const_cast<KDevelop::ParseJob*>(session()->job()),
@@ -1415,6 +1409,7 @@ VisitResult ExpressionVisitor::visitCall(const ZigNode &node, const ZigNode &par
     if (finder.delayedTypes.size() > 0) {
         qCDebug(KDEV_ZIG) << "visit delayed return type" << startArg;
         uint32_t i = 0;
+        const auto params = node.callParams();
         // Resolve types
         QMap<IndexedString, AbstractType::Ptr> resolvedTypes;
 
@@ -1432,7 +1427,7 @@ VisitResult ExpressionVisitor::visitCall(const ZigNode &node, const ZigNode &par
 
         for (const auto &arg: args.mid(startArg)) {
             if (auto param = arg.dynamicCast<Zig::DelayedType>()) {
-                ZigNode argValueNode = node.callParamAt(i);
+                ZigNode argValueNode = i < static_cast<uint32_t>(params.size()) ? params.at(i) : ZigNode{node.ast, 0};
                 if (!argValueNode.isRoot()) {
                     ExpressionVisitor valueVisitor(this);
                     valueVisitor.startVisiting(argValueNode, node);
@@ -1826,9 +1821,8 @@ VisitResult ExpressionVisitor::visitSwitch(const ZigNode &node, const ZigNode &p
                 const ZigNode caseNode = node.extraDataAsNode(j);
                 Q_ASSERT(!caseNode.isRoot());
                 // qCDebug(KDEV_ZIG) << "checking case" << j << "node tag is" << caseNode.tag();
-                const auto n = caseNode.switchCaseCount();
-                for (uint32_t i=0; i<n; i++) {
-                    const ZigNode caseValue = caseNode.switchCaseItemAt(i);
+                const auto items = caseNode.switchCaseItems();
+                for (const ZigNode &caseValue : items) {
                     // qCDebug(KDEV_ZIG) << "checking case item" << i << "of case" << j << "tag" << caseValue.tag();
                     ExpressionVisitor caseVisitor(this);
                     caseVisitor.setInferredType(switchValue->asType());
@@ -2126,10 +2120,9 @@ VisitResult ExpressionVisitor::visitFnProto(const ZigNode &node, const ZigNode &
     } else {
         FunctionType::Ptr fn(new FunctionType);
 
-        const auto n = node.fnParamCount();
-        for (uint32_t i=0; i < n; i++) {
-            auto paramData = node.fnParamData(i);
-            ZigNode paramType = {node.ast, paramData.type_expr};
+        const auto params = node.fnParams();
+        for (int i=0; i < params.size(); i++) {
+            ZigNode paramType = {node.ast, params.at(i).type_expr};
             ExpressionVisitor v(this);
             v.startVisiting(paramType, node);
             fn->addArgument(v.lastType(), i);
@@ -98,7 +98,6 @@ public:
     VisitResult callBuiltinIntCast(const ZigNode &node);
     VisitResult callBuiltinEnumFromInt(const ZigNode &node);
     VisitResult callBuiltinIntFromEnum(const ZigNode &node);
-    VisitResult callBuiltinBoolFromInt(const ZigNode &node);
     VisitResult callBuiltinIntFromBool(const ZigNode &node);
     VisitResult callBuiltinCImport(const ZigNode &node);
     VisitResult callBuiltinCInclude(const ZigNode &node);
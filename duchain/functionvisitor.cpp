@@ -7,15 +7,6 @@ namespace Zig
 {
 using namespace KDevelop;
 
-static VisitResult functionVisitorCallback(ZAst* ast, NodeIndex node, NodeIndex parent, void *data)
-{
-    FunctionVisitor *visitor = static_cast<FunctionVisitor *>(data);
-    Q_ASSERT(visitor);
-    ZigNode childNode = {ast, node};
-    ZigNode parentNode = {ast, parent};
-    return visitor->visitNode(childNode, parentNode);
-}
-
 FunctionVisitor::FunctionVisitor(ParseSession* session, const DUContext* context)
     : m_context(context), m_session(session)
 {
@@ -42,7 +33,7 @@ void FunctionVisitor::startVisiting(const ZigNode &node, const ZigNode &parent)
 void FunctionVisitor::visitChildren(const ZigNode &node, const ZigNode &parent)
 {
     Q_UNUSED(parent);
-    ast_visit(node.ast, node.index, functionVisitorCallback, this);
+    visitChildNodes(this, node);
 }
 
 VisitResult FunctionVisitor::visitNode(const ZigNode &node, const ZigNode &parent)
@@ -27,6 +27,7 @@
 #include "types/slicetype.h"
 
 #include "helpers.h"
+#include "importscheduler.h"
 #include "zigdebug.h"
 #include "delayedtypevisitor.h"
 #include "types/enumtype.h"
@@ -64,7 +65,10 @@ void Helper::scheduleDependency(
     }
     if ( needsReschedule ) {
         // qCDebug(KDEV_ZIG) << "Rescheduled " << dependency << "at priority" << betterThanPriority;
-        bgparser->addDocument(dependency, TopDUContext::ForceUpdate, betterThanPriority - 1,
+        // C headers are parsed by the clang plugin which has its own features
+        const int features = dependency.str().endsWith(QLatin1String(".zig"))
+            ? (TopDUContext::ForceUpdate | ImportScheduler::DependencyFeature) : TopDUContext::ForceUpdate;
+        bgparser->addDocument(dependency, static_cast<TopDUContext::Features>(features), betterThanPriority - 1,
                               notifyWhenReady, ParseJob::FullSequentialProcessing);
     }
 }
@@ -93,6 +97,15 @@ Declaration* Helper::accessAttribute(
         return accessAttribute(ptr->baseType(), attribute, topContext);
     }
 
+    if (!delayedImportFile(accessed).isEmpty()) {
+        // The module may have been parsed since the import was evaluated
+        const auto module = resolveDelayedImport(accessed);
+        if (module == accessed) {
+            return nullptr;
+        }
+        return accessAttribute(module, attribute, topContext);
+    }
+
     if (auto s = accessed.dynamicCast<StructureType>()) {
         DUChainReadLocker lock;
         // const bool isModule = s->modifiers() & ModuleModifier;
@@ -332,7 +345,7 @@ static inline bool canFindBeyondUse(const DUContext* ctx)
 }
 
 Declaration* Helper::declarationForName(
-    const QString& name,
+    const IndexedIdentifier& name,
     const CursorInRevision& location,
     DUChainPointer<const DUContext> context,
     const KDevelop::Declaration* excludedDeclaration)
@@ -342,7 +355,7 @@ Declaration* Helper::declarationForName(
     bool findBeyondUse = canFindBeyondUse(currentContext);
     //qCDebug(KDEV_ZIG) << "Find" << name << " beyond use" << findBeyondUse;
     CursorInRevision findUntil = findBeyondUse ? currentContext->topContext()->range().end : location;
-    auto identifier = KDevelop::Identifier(name);
+    const auto identifier = name.identifier();
     // for (Declaration* declaration: context->localDeclarations()) {
     //     qCDebug(KDEV_ZIG) << "local decls " << declaration->toString();
     // }
@@ -644,8 +657,31 @@ AbstractType::Ptr Helper::evaluateUnsignedOp(
     return AbstractType::Ptr(r);
 }
 
+AbstractType::Ptr Helper::resolveDelayedImport(const AbstractType::Ptr& type)
+{
+    const IndexedString file = delayedImportFile(type);
+    if (file.isEmpty()) {
+        return type;
+    }
+    DUChainReadLocker lock;
+    auto *mod = DUChain::self()->chainForDocument(file);
+    if (mod && mod->owner() && mod->owner()->abstractType()) {
+        return mod->owner()->abstractType();
+    }
+    return type;
+}
+
+IndexedString Helper::delayedImportFile(const AbstractType::Ptr& type)
+{
+    auto delayed = type.dynamicCast<DelayedType>();
+    if (!delayed || !(delayed->modifiers() & ModuleModifier)) {
+        return IndexedString();
+    }
+    return delayed->identifier();
+}
+
 KDevelop::Declaration* Helper::declarationForImportedModuleName(
-        const QString& module, const QString& currentFile)
+        const QString& module, const QString& currentFile, int priority)
 {
     QStringList parts = module.split(QStringLiteral("."));
     if (parts.isEmpty()) {
@@ -672,7 +708,13 @@ KDevelop::Declaration* Helper::declarationForImportedModuleName(
     //         doc, KDevelop::TopDUContext::AllDeclarationsAndContexts).data();
     //     lock.lock();
     // }
-    if (!mod || !mod->owner()) {
+    if (!mod) {
+        lock.unlock();
+        qCDebug(KDEV_ZIG) << "imported module is not parsed" << module;
+        ImportScheduler::self().demandImport(IndexedString(currentFile), IndexedString(package), priority);
+        return nullptr;
+    }
+    if (!mod->owner()) {
         qCDebug(KDEV_ZIG) << "imported module is invalid" << module;
         return nullptr;
     }
@@ -683,6 +725,12 @@ KDevelop::Declaration* Helper::declarationForImportedModuleName(
             qCDebug(KDEV_ZIG) << "cant import module with empty part " << module;
             return nullptr;
         }
+        const IndexedString delayed = delayedImportFile(resolveDelayedImport(decl->abstractType()));
+        if (!delayed.isEmpty()) {
+            qCDebug(KDEV_ZIG) << "delayed import for" << part << "of" << module;
+            ImportScheduler::self().demandImport(IndexedString(currentFile), delayed, priority);
+            return nullptr;
+        }
         decl = Helper::accessAttribute(decl->abstractType(), part, decl->topContext());
         if (!decl) {
             qCDebug(KDEV_ZIG) << "no decl for" << part << "of" << module;
@@ -734,6 +782,20 @@ QString Helper::zigExecutablePath(const IProject* project)
     return QStringLiteral("/usr/bin/zig");
 }
 
+QByteArray Helper::formatSource(const QByteArray& source, const ZAst* tree)
+{
+    uint32_t len = 0;
+    const char* formatted = tree
+        ? ast_render(tree, &len)
+        : ast_format(source.constData(), source.size(), true, &len);
+    if (!formatted) {
+        return QByteArray();
+    }
+    QByteArray result(formatted, len);
+    destroy_formatted(formatted, len);
+    return result;
+}
+
 void Helper::loadPackages(const KDevelop::IProject* project)
 {
     if (!project) {
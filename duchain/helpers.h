@@ -18,6 +18,7 @@
 #include <language/languageexport.h>
 
 #include "kdevzigduchain_export.h"
+#include "kdevzigastparser.h"
 #include "types/builtintype.h"
 #include "types/slicetype.h"
 #include "types/pointertype.h"
@@ -41,6 +42,13 @@ public:
 
     static QString zigExecutablePath(const KDevelop::IProject* project);
 
+    /**
+     * Format source in-process like zig fmt. If tree is the parsed ast of
+     * source it is rendered directly instead of parsing again.
+     * Returns a null array if the source has errors.
+     */
+    static QByteArray formatSource(const QByteArray& source, const ZAst* tree = nullptr);
+
     // Caller must NOT be holding projectPathLock for these
     static QString stdLibPath(const KDevelop::IProject* project);
     static void loadPackages(const KDevelop::IProject* project);
@@ -60,9 +68,10 @@ public:
     static QUrl includePath(const QString &name, const QString& currentFile);
 
     // Import a declaration based on the qualified name
-    // eg "std.builtin.Type"
+    // eg "std.builtin.Type". Modules on the way that are not parsed
+    // yet are scheduled for the current file, see ImportScheduler.
     static KDevelop::Declaration* declarationForImportedModuleName(
-           const QString& module, const QString& currentFile);
+           const QString& module, const QString& currentFile, int priority = 0);
 
     static QVector<QUrl> getSearchPaths(const QUrl& workingOnDocument);
 
@@ -76,12 +85,24 @@ public:
      * If excludedDeclaration is provided, do not use that one if found.
      **/
     static KDevelop::Declaration* declarationForName(
-        const QString& name,
+        const KDevelop::IndexedIdentifier& name,
         const KDevelop::CursorInRevision& location,
         KDevelop::DUChainPointer<const KDevelop::DUContext> context,
         const KDevelop::Declaration* excludedDeclaration = nullptr
     );
 
+    static KDevelop::Declaration* declarationForName(
+        const QString& name,
+        const KDevelop::CursorInRevision& location,
+        KDevelop::DUChainPointer<const KDevelop::DUContext> context,
+        const KDevelop::Declaration* excludedDeclaration = nullptr
+    )
+    {
+        return declarationForName(
+            KDevelop::IndexedIdentifier(KDevelop::Identifier(name)),
+            location, context, excludedDeclaration);
+    }
+
     /**
      * @brief Get the declaration of 'accessed.attribute', or return null.
      *
@@ -105,6 +126,16 @@ public:
         return accessAttribute(accessed, KDevelop::IndexedIdentifier(KDevelop::Identifier(attribute)), topContext);
     }
 
+    /**
+     * An @import of a file that was not parsed when it was evaluated is a
+     * delayed type with the module modifier. Returns the module type once
+     * the file is parsed, other types are returned as is.
+     */
+    static KDevelop::AbstractType::Ptr resolveDelayedImport(const KDevelop::AbstractType::Ptr& type);
+
+    // File of a delayed @import or empty if the type is not one
+    static KDevelop::IndexedString delayedImportFile(const KDevelop::AbstractType::Ptr& type);
+
 
     /**
      * Follows the context up to the closest container. Eg the builtin @This();
@@ -0,0 +1,305 @@
+#include "importscheduler.h"
+
+#include <QFile>
+#include <QUrl>
+
+#include <interfaces/icore.h>
+#include <interfaces/ilanguagecontroller.h>
+#include <language/backgroundparser/backgroundparser.h>
+#include <language/duchain/duchain.h>
+#include <language/duchain/duchainlock.h>
+
+#include "kdevzigastparser.h"
+#include "zignode.h"
+#include "helpers.h"
+#include "zigdebug.h"
+
+using namespace KDevelop;
+
+namespace Zig
+{
+
+ImportScheduler &ImportScheduler::self()
+{
+    static ImportScheduler scheduler;
+    return scheduler;
+}
+
+ImportScheduler::Mode ImportScheduler::mode() const
+{
+    return m_mode.load(std::memory_order_relaxed);
+}
+
+void ImportScheduler::setMode(Mode mode)
+{
+    m_mode.store(mode, std::memory_order_relaxed);
+}
+
+QVector<IndexedString> ImportScheduler::scanImports(const IndexedString &document, const QByteArray &source)
+{
+    QVector<IndexedString> imports;
+    ZigImportList list(scan_imports(source.constData(), source.size(), true));
+    if (!list.data()) {
+        return imports;
+    }
+    const QString currentFile = document.str();
+    for (uint32_t i = 0; i < list.data()->count; i++) {
+        const SourceSlice &name = list.data()->imports[i];
+        const QUrl path = Helper::importPath(QString::fromUtf8(name.data, name.len), currentFile);
+        if (path.isEmpty()) {
+            continue;
+        }
+        const IndexedString dependency(path);
+        if (!imports.contains(dependency)) {
+            imports.append(dependency);
+        }
+    }
+    return imports;
+}
+
+QVector<IndexedString> ImportScheduler::importsOf(const IndexedString &file)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        auto it = m_nodes.constFind(file);
+        if (it != m_nodes.constEnd() && it->scanned) {
+            return it->imports;
+        }
+    }
+    // Not opened so what is on disk is what will be parsed. Read without
+    // the lock, another thread scanning the same file is harmless.
+    QFile f(file.toUrl().toLocalFile());
+    QByteArray source;
+    if (f.open(QIODevice::ReadOnly)) {
+        source = f.readAll();
+    }
+    const QVector<IndexedString> imports = scanImports(file, source);
+
+    QMutexLocker lock(&m_mutex);
+    Node &node = m_nodes[file];
+    if (!node.scanned) {
+        node.imports = imports;
+        node.scanned = true;
+        m_stats.scanned++;
+    }
+    return node.imports;
+}
+
+ImportOrder ImportScheduler::order(const IndexedString &document, const QByteArray &source, const IsParsedFn &isParsed)
+{
+    const bool lazy = mode() == LazyImports;
+    const QVector<IndexedString> documentImports = scanImports(document, source);
+    {
+        QMutexLocker lock(&m_mutex);
+        Node &documentNode = m_nodes[document];
+        documentNode.imports = documentImports;
+        documentNode.scanned = true;
+        m_stats.scanned++;
+    }
+
+    QHash<IndexedString, bool> parsed;
+    auto needsParse = [&](const IndexedString &file) {
+        if (file == document) {
+            return true;
+        }
+        auto it = parsed.constFind(file);
+        if (it == parsed.constEnd()) {
+            it = parsed.insert(file, isParsed(file));
+        }
+        return !it.value();
+    };
+
+    // Collect the unparsed part of the import graph first. Files are read
+    // and isParsed takes DUChain locks so none of it holds m_mutex.
+    // Lazily the imports of imports are not read, they are demanded
+    // when accessed.
+    QHash<IndexedString, QVector<IndexedString>> graph;
+    graph.insert(document, {});
+    QVector<IndexedString> pending{document};
+    while (!pending.isEmpty()) {
+        const IndexedString file = pending.takeLast();
+        const QVector<IndexedString> imports = (file == document) ? documentImports
+            : lazy ? QVector<IndexedString>() : importsOf(file);
+        QVector<IndexedString> edges;
+        for (const IndexedString &dependency : imports) {
+            if (!needsParse(dependency)) {
+                continue;
+            }
+            edges.append(dependency);
+            if (!graph.contains(dependency)) {
+                graph.insert(dependency, {});
+                pending.append(dependency);
+            }
+        }
+        graph[file] = edges;
+    }
+
+    QMutexLocker lock(&m_mutex);
+
+    // Tarjan's strongly connected components. A component is complete
+    // once everything it imports is, so they are found in parse order.
+    ImportOrder result;
+    QHash<IndexedString, int> indexes;
+    QHash<IndexedString, int> lowlinks;
+    QHash<IndexedString, int> levels;
+    QVector<IndexedString> stack;
+    QSet<IndexedString> onStack;
+    std::function<void(const IndexedString &)> visit = [&](const IndexedString &file) {
+        const int index = indexes.size();
+        indexes.insert(file, index);
+        lowlinks.insert(file, index);
+        stack.append(file);
+        onStack.insert(file);
+        for (const IndexedString &dependency : graph.value(file)) {
+            if (!indexes.contains(dependency)) {
+                visit(dependency);
+                lowlinks[file] = qMin(lowlinks.value(file), lowlinks.value(dependency));
+            } else if (onStack.contains(dependency)) {
+                lowlinks[file] = qMin(lowlinks.value(file), indexes.value(dependency));
+            }
+        }
+        if (lowlinks.value(file) != index) {
+            return;
+        }
+
+        QVector<IndexedString> members;
+        do {
+            members.append(stack.takeLast());
+            onStack.remove(members.last());
+        } while (members.last() != file);
+
+        int level = 0;
+        for (const IndexedString &member : std::as_const(members)) {
+            for (const IndexedString &dependency : graph.value(member)) {
+                auto it = levels.constFind(dependency);
+                if (it != levels.constEnd() && !members.contains(dependency)) {
+                    level = qMax(level, it.value() + 1);
+                }
+            }
+        }
+        const int component = m_nextComponent++;
+        for (const IndexedString &member : std::as_const(members)) {
+            levels.insert(member, level);
+            Node &node = m_nodes[member];
+            node.component = component;
+            node.componentSize = members.size();
+            node.reparses = 0;
+            result.files.append(member);
+            result.levels.append(level);
+            result.components.append(component);
+        }
+    };
+    visit(document);
+
+    // Keep the document last within its component
+    const int last = result.files.indexOf(document);
+    if (last != result.files.size() - 1) {
+        result.files.move(last, result.files.size() - 1);
+        result.levels.move(last, result.levels.size() - 1);
+        result.components.move(last, result.components.size() - 1);
+    }
+    return result;
+}
+
+bool ImportScheduler::scheduleImports(const IndexedString &document, const QByteArray &source, int priority)
+{
+    {
+        // The document changed so it may access other modules
+        QMutexLocker lock(&m_mutex);
+        auto it = m_nodes.find(document);
+        if (it != m_nodes.end()) {
+            it->demanded.clear();
+            it->pendingDemand = false;
+        }
+    }
+    const ImportOrder order = this->order(document, source, [](const IndexedString &file) {
+        DUChainReadLocker lock;
+        return DUChain::self()->chainForDocument(file) != nullptr;
+    });
+    const int n = order.files.size() - 1;
+    if (n <= 0) {
+        return false;
+    }
+
+    // A lower priority is parsed first and the jobs are sequential so
+    // each level is done before the one that imports it starts
+    const int documentLevel = order.levels.last();
+    const int documentComponent = order.components.last();
+    bool deferred = false;
+    for (int i = 0; i < n; i++) {
+        const int filePriority = priority - (documentLevel - order.levels.at(i));
+        Helper::scheduleDependency(order.files.at(i), filePriority + 1);
+        if (order.components.at(i) != documentComponent) {
+            deferred = true;
+        }
+    }
+
+    QMutexLocker lock(&m_mutex);
+    m_stats.scheduled += n;
+    if (deferred) {
+        m_stats.deferred++;
+    }
+    qCDebug(KDEV_ZIG) << "Scheduled" << n << "imports of" << document.str()
+                      << "levels" << documentLevel << "deferred" << deferred;
+    return deferred;
+}
+
+bool ImportScheduler::shouldReparse(const IndexedString &document, const QSet<IndexedString> &unresolved)
+{
+    // Each parse of a file in a cycle can resolve one more of the others
+    constexpr int maxReparses = 3;
+    QMutexLocker lock(&m_mutex);
+    auto it = m_nodes.find(document);
+    if (it == m_nodes.end() || it->component < 0) {
+        return false;
+    }
+    for (const IndexedString &file : unresolved) {
+        auto dependency = m_nodes.constFind(file);
+        if (dependency == m_nodes.constEnd() || dependency->component != it->component) {
+            continue;
+        }
+        if (it->reparses >= qMin(it->componentSize - 1, maxReparses)) {
+            return false;
+        }
+        it->reparses++;
+        m_stats.reparsed++;
+        return true;
+    }
+    return false;
+}
+
+bool ImportScheduler::demandImport(const IndexedString &document, const IndexedString &module, int priority)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        Node &node = m_nodes[document];
+        if (node.demanded.contains(module)) {
+            return false;
+        }
+        node.demanded.insert(module);
+        node.pendingDemand = true;
+        m_stats.demanded++;
+    }
+    qCDebug(KDEV_ZIG) << "Demanded" << module.str() << "from" << document.str();
+    Helper::scheduleDependency(module, priority);
+    return true;
+}
+
+bool ImportScheduler::takeDemanded(const IndexedString &document)
+{
+    QMutexLocker lock(&m_mutex);
+    auto it = m_nodes.find(document);
+    if (it == m_nodes.end() || !it->pendingDemand) {
+        return false;
+    }
+    it->pendingDemand = false;
+    return true;
+}
+
+ImportScheduler::Stats ImportScheduler::stats() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_stats;
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QVector>
+
+#include <serialization/indexedstring.h>
+#include <language/duchain/topducontext.h>
+
+#include "kdevzigduchain_export.h"
+
+namespace Zig
+{
+
+// Files reachable through @import from a document that are not parsed
+// yet, imports come before the files that import them
+struct KDEVZIGDUCHAIN_EXPORT ImportOrder
+{
+    QVector<KDevelop::IndexedString> files;
+    // Longest chain of imports below each file, files that import
+    // each other have the same level and component
+    QVector<int> levels;
+    QVector<int> components;
+};
+
+/**
+ * Feeds the background parser in @import order so a file is parsed after
+ * what it imports instead of being parsed again once they are done.
+ * Imports are found by only tokenizing the sources, see scan_imports.
+ * Files that import each other are parsed again a bounded number of times.
+ * In lazy mode modules past the imports of a document stay delayed types
+ * until a member is accessed through them, see demandImport.
+ */
+class KDEVZIGDUCHAIN_EXPORT ImportScheduler
+{
+public:
+    enum Mode {
+        // Every file reachable through @import is parsed
+        EagerImports,
+        // Only the imports of a document are parsed up front, modules
+        // further down are parsed once a member is accessed through them
+        LazyImports,
+    };
+
+    using IsParsedFn = std::function<bool(const KDevelop::IndexedString &)>;
+
+    // Feature of parse jobs for files that are only parsed because another
+    // file imports them, they do not schedule their own imports. It comes
+    // after the custom features of ParseJob.
+    static constexpr int DependencyFeature = KDevelop::TopDUContext::LastFeature << 4;
+
+    static ImportScheduler &self();
+
+    // Lazy unless KDEV_ZIG_EAGER_IMPORTS is set
+    Mode mode() const;
+    void setMode(Mode mode);
+
+    // Imports of a document that exist, duplicates removed
+    static QVector<KDevelop::IndexedString> scanImports(const KDevelop::IndexedString &document, const QByteArray &source);
+
+    // Order the unparsed files reachable from the document, which is last.
+    // Files are read and isParsed is called without holding the scheduler lock.
+    ImportOrder order(const KDevelop::IndexedString &document, const QByteArray &source, const IsParsedFn &isParsed);
+
+    /**
+     * Schedule the unparsed imports of the document, deepest first.
+     * Returns true if the document has imports that must be parsed
+     * before it, it should then be scheduled again after them.
+     */
+    bool scheduleImports(const KDevelop::IndexedString &document, const QByteArray &source, int priority);
+
+    /**
+     * Whether the document should be parsed again for its unresolved
+     * imports. Only imports that also import the document are waited
+     * for, at most once for each other file in the cycle up to a limit.
+     */
+    bool shouldReparse(const KDevelop::IndexedString &document, const QSet<KDevelop::IndexedString> &unresolved);
+
+    /**
+     * Schedule a module that a member of was accessed from the document
+     * while it is still a delayed @import. Each module is requested once
+     * per edit of the document. Returns true if it was scheduled.
+     */
+    bool demandImport(const KDevelop::IndexedString &document, const KDevelop::IndexedString &module, int priority);
+
+    // Whether modules were demanded by the document since the last call,
+    // it should then be parsed again after them
+    bool takeDemanded(const KDevelop::IndexedString &document);
+
+    struct Stats
+    {
+        uint32_t scanned = 0;
+        uint32_t scheduled = 0;
+        uint32_t deferred = 0;
+        uint32_t reparsed = 0;
+        uint32_t demanded = 0;
+    };
+    Stats stats() const;
+
+private:
+    struct Node
+    {
+        QVector<KDevelop::IndexedString> imports;
+        int component = -1;
+        int componentSize = 0;
+        int reparses = 0;
+        bool scanned = false;
+        // Modules requested through delayed imports and whether any
+        // were added since the document was last parsed
+        QSet<KDevelop::IndexedString> demanded;
+        bool pendingDemand = false;
+    };
+
+    // Scans the file on disk once, takes m_mutex so it must not be held
+    QVector<KDevelop::IndexedString> importsOf(const KDevelop::IndexedString &file);
+
+    mutable QMutex m_mutex;
+    QHash<KDevelop::IndexedString, Node> m_nodes;
+    int m_nextComponent = 0;
+    // Read while DUChain locks are held so it does not take m_mutex
+    std::atomic<Mode> m_mode{qEnvironmentVariableIsSet("KDEV_ZIG_EAGER_IMPORTS") ? EagerImports : LazyImports};
+    Stats m_stats;
+};
+
+}
@@ -522,6 +522,23 @@ enum NodeKind: uint32_t
     FnProto
 };
 
+enum ParseMode: uint32_t
+{
+    ParseMode_Full = 0,
+    // Only declarations, the bodies of fns that do not return a type
+    // are skipped. Used for dependencies that are not open.
+    ParseMode_Skeleton = 1,
+};
+
+// Bit flags computed for each node at parse time
+enum NodeFlags: uint8_t
+{
+    NodeFlag_None = 0,
+    // Var decl whose value (container, error set or @cImport) provides
+    // the declaration instead, eg const Foo = struct {}
+    NodeFlag_SkipDecl = 1 << 0,
+};
+
 enum VisitResult: uint32_t
 {
     Break = 0,
@@ -535,6 +552,132 @@ enum CaptureType: uint32_t
     Error
 };
 
+// Must match BuiltinFnId in kdevzigastparser.zig
+enum BuiltinFnId: uint32_t
+{
+    BuiltinFnId_invalid = 0,
+    BuiltinFnId_addrSpaceCast,
+    BuiltinFnId_addWithOverflow,
+    BuiltinFnId_alignCast,
+    BuiltinFnId_alignOf,
+    BuiltinFnId_as,
+    BuiltinFnId_atomicLoad,
+    BuiltinFnId_atomicRmw,
+    BuiltinFnId_atomicStore,
+    BuiltinFnId_bitCast,
+    BuiltinFnId_bitOffsetOf,
+    BuiltinFnId_bitSizeOf,
+    BuiltinFnId_branchHint,
+    BuiltinFnId_breakpoint,
+    BuiltinFnId_mulAdd,
+    BuiltinFnId_byteSwap,
+    BuiltinFnId_bitReverse,
+    BuiltinFnId_offsetOf,
+    BuiltinFnId_call,
+    BuiltinFnId_cDefine,
+    BuiltinFnId_cImport,
+    BuiltinFnId_cInclude,
+    BuiltinFnId_clz,
+    BuiltinFnId_cmpxchgStrong,
+    BuiltinFnId_cmpxchgWeak,
+    BuiltinFnId_compileError,
+    BuiltinFnId_compileLog,
+    BuiltinFnId_constCast,
+    BuiltinFnId_ctz,
+    BuiltinFnId_cUndef,
+    BuiltinFnId_cVaArg,
+    BuiltinFnId_cVaCopy,
+    BuiltinFnId_cVaEnd,
+    BuiltinFnId_cVaStart,
+    BuiltinFnId_divExact,
+    BuiltinFnId_divFloor,
+    BuiltinFnId_divTrunc,
+    BuiltinFnId_embedFile,
+    BuiltinFnId_enumFromInt,
+    BuiltinFnId_errorFromInt,
+    BuiltinFnId_errorName,
+    BuiltinFnId_errorReturnTrace,
+    BuiltinFnId_errorCast,
+    BuiltinFnId_export,
+    BuiltinFnId_extern,
+    BuiltinFnId_fence,
+    BuiltinFnId_field,
+    BuiltinFnId_fieldParentPtr,
+    BuiltinFnId_floatCast,
+    BuiltinFnId_floatFromInt,
+    BuiltinFnId_frameAddress,
+    BuiltinFnId_hasDecl,
+    BuiltinFnId_hasField,
+    BuiltinFnId_import,
+    BuiltinFnId_inComptime,
+    BuiltinFnId_intCast,
+    BuiltinFnId_intFromBool,
+    BuiltinFnId_intFromEnum,
+    BuiltinFnId_intFromError,
+    BuiltinFnId_intFromFloat,
+    BuiltinFnId_intFromPtr,
+    BuiltinFnId_max,
+    BuiltinFnId_memcpy,
+    BuiltinFnId_memset,
+    BuiltinFnId_min,
+    BuiltinFnId_wasmMemorySize,
+    BuiltinFnId_wasmMemoryGrow,
+    BuiltinFnId_mod,
+    BuiltinFnId_mulWithOverflow,
+    BuiltinFnId_panic,
+    BuiltinFnId_popCount,
+    BuiltinFnId_prefetch,
+    BuiltinFnId_ptrCast,
+    BuiltinFnId_ptrFromInt,
+    BuiltinFnId_rem,
+    BuiltinFnId_returnAddress,
+    BuiltinFnId_select,
+    BuiltinFnId_setAlignStack,
+    BuiltinFnId_setCold,
+    BuiltinFnId_setEvalBranchQuota,
+    BuiltinFnId_setFloatMode,
+    BuiltinFnId_setRuntimeSafety,
+    BuiltinFnId_shlExact,
+    BuiltinFnId_shlWithOverflow,
+    BuiltinFnId_shrExact,
+    BuiltinFnId_shuffle,
+    BuiltinFnId_sizeOf,
+    BuiltinFnId_splat,
+    BuiltinFnId_reduce,
+    BuiltinFnId_src,
+    BuiltinFnId_sqrt,
+    BuiltinFnId_sin,
+    BuiltinFnId_cos,
+    BuiltinFnId_tan,
+    BuiltinFnId_exp,
+    BuiltinFnId_exp2,
+    BuiltinFnId_log,
+    BuiltinFnId_log2,
+    BuiltinFnId_log10,
+    BuiltinFnId_abs,
+    BuiltinFnId_floor,
+    BuiltinFnId_ceil,
+    BuiltinFnId_trunc,
+    BuiltinFnId_round,
+    BuiltinFnId_subWithOverflow,
+    BuiltinFnId_tagName,
+    BuiltinFnId_This,
+    BuiltinFnId_trap,
+    BuiltinFnId_truncate,
+    BuiltinFnId_Type,
+    BuiltinFnId_typeInfo,
+    BuiltinFnId_typeName,
+    BuiltinFnId_TypeOf,
+    BuiltinFnId_unionInit,
+    BuiltinFnId_Vector,
+    BuiltinFnId_volatileCast,
+    BuiltinFnId_workGroupId,
+    BuiltinFnId_workGroupSize,
+    BuiltinFnId_workItemId,
+    BuiltinFnId_FieldType,
+    BuiltinFnId_disableInstrumentation
+};
+
 enum CompletionResultType: uint32_t
 {
     CompletionUnknown = 0,
@@ -549,6 +692,7 @@ struct ZCompletion
 
 struct ZAst;
 
+// Columns are in UTF-16 code units like KTextEditor::Cursor
 struct SourceLocation
 {
     uint32_t line;
@@ -593,11 +737,27 @@ struct ZError
     const char* message;
 };
 
+// All errors of an ast in a single allocation, free with destroy_errors
+struct ZErrorList
+{
+    uint32_t count;
+    uint32_t size;
+    ZError *errors;
+};
+
+// Names passed to @import found by tokenizing a source, see scan_imports
+struct ZImportList
+{
+    uint32_t count;
+    SourceSlice *imports;
+};
+
 typedef uint32_t NodeIndex;
 typedef uint32_t TokenIndex;
 typedef uint32_t ExtraDataIndex;
 typedef VisitResult (*VisitorCallbackFn)(ZAst* tree, NodeIndex node, NodeIndex parent, void *data);
 #define INVALID_TOKEN UINT32_MAX
+#define INVALID_IDENT UINT32_MAX
 
 
 struct ArrayTypeSentinel
@@ -689,19 +849,95 @@ struct NodeSubRange
     }
 };
 
-ZAst *parse_ast(const char *name, const char *source, bool print_ast = false);
+struct NodeSpan
+{
+    const NodeIndex *data;
+    uint32_t len;
+};
+
+// Structure of arrays view of the ast. The pointers are owned by the
+// ast and remain valid until it is destroyed.
+struct AstView
+{
+    uint32_t node_count;
+    uint32_t extra_data_count;
+    uint32_t token_count;
+    const uint8_t *node_tags;
+    const NodeData *node_data;
+    const TokenIndex *node_main_tokens;
+    const uint32_t *extra_data;
+    const uint8_t *token_tags;
+    const uint32_t *token_starts;
+    // Direct children of node i are
+    // child_nodes[child_offsets[i]] to child_nodes[child_offsets[i+1]]
+    const uint32_t *child_offsets;
+    const NodeIndex *child_nodes;
+    // The root is its own parent
+    const NodeIndex *node_parents;
+    // Interned id of each identifier token or INVALID_IDENT
+    uint32_t ident_count;
+    const uint32_t *token_idents;
+    // Start of the first and last token of each node
+    const SourceRange *node_ranges;
+    // NodeKind and NodeFlags of each node
+    const uint8_t *node_kinds;
+    const uint8_t *node_flags;
+};
+
+// NOTE: Strings are passed with a length and are never scanned for a terminator.
+// If is_terminated is set the byte after the end of a source must be a NUL (as
+// with a QByteArray) and the ast borrows the source, otherwise a copy is made.
+ZAst *parse_ast(const char *name, uint32_t name_len, const char *source, uint32_t source_len, bool is_terminated, bool print_ast = false, ParseMode mode = ParseMode_Full);
+ParseMode ast_parse_mode(const ZAst *tree);
+// Parse the new contents of a document where the range edit_start..edit_end of
+// the old tree's source was replaced, in the old tree's mode. Returns null on
+// failure, the old tree is not modified.
+ZAst *reparse_ast(const ZAst *old, uint32_t edit_start, uint32_t edit_end, const char *source, uint32_t source_len, bool is_terminated);
+// Bodies of the root fn and test decls a reparse did not touch while nothing
+// outside of the bodies changed. Empty for a tree that was not reparsed.
+NodeSpan ast_unchanged_bodies(const ZAst *tree);
+// On-disk cache of parsed asts keyed by the parser version and the source.
+// The load returns null if there is no valid cache file for the key of the
+// source, otherwise the cached arrays are mapped instead of parsing again.
+uint64_t ast_cache_key(const char *source, uint32_t source_len, ParseMode mode = ParseMode_Full);
+bool ast_cache_write(const ZAst *tree, const char *path, uint32_t path_len);
+// Contents of the cache file for the key so it can be written by another thread,
+// null if the tree has errors. The length is written to out_len and the result
+// must be freed with destroy_cache_data.
+const char *ast_cache_data(const ZAst *tree, uint64_t key, uint32_t *out_len);
+void destroy_cache_data(const char *data, uint32_t len);
+ZAst *ast_cache_load(const char *name, uint32_t name_len, const char *path, uint32_t path_len, const char *source, uint32_t source_len, bool is_terminated, uint64_t key, ParseMode mode = ParseMode_Full);
+// Source the ast was parsed from
+SourceSlice ast_source(const ZAst *tree);
 uint32_t ast_error_count(const ZAst *tree);
 void destroy_ast(ZAst *tree);
 
-ZError *ast_error_at(const ZAst* tree, uint32_t index);
-void destroy_error(ZError *err);
+ZErrorList *ast_errors(const ZAst* tree);
+void destroy_errors(ZErrorList *errors);
+
+// Only tokenizes the source, the names point into it so it must outlive
+// the list. Free with destroy_imports.
+ZImportList *scan_imports(const char *source, uint32_t source_len, bool is_terminated);
+void destroy_imports(ZImportList *imports);
 
-ZCompletion* complete_expr(const char *text, const char *following);
+ZCompletion* complete_expr(const char *text, uint32_t text_len, const char *following, uint32_t following_len);
 void destroy_completion(ZCompletion *completion);
 
-uint32_t ast_tag_by_name(const char *name);
+uint32_t ast_tag_by_name(const char *name, uint32_t len);
+
+// Format like zig fmt, returns null if the source has errors. The length
+// is written to out_len and the result must be freed with destroy_formatted
+const char *ast_format(const char *source, uint32_t source_len, bool is_terminated, uint32_t *out_len);
+const char *ast_render(const ZAst *tree, uint32_t *out_len);
+void destroy_formatted(const char *formatted, uint32_t len);
+
+// NOTE: The view is stored in the ast at ast_view_offset() so it can
+// also be found without a call
+const AstView *ast_view(const ZAst *tree);
+size_t ast_view_offset();
 
 NodeKind ast_node_kind(const ZAst *tree, NodeIndex node);
+uint8_t ast_node_flags(const ZAst *tree, NodeIndex node);
 NodeTag ast_node_tag(const ZAst* tree, NodeIndex node);
 NodeData ast_node_data(const ZAst *tree, NodeIndex node);
 uint32_t ast_extra_data(const ZAst *tree, ExtraDataIndex index);
@@ -711,7 +947,10 @@ VarData ast_var_data(const ZAst *tree, NodeIndex node);
 PtrTypeData ast_ptr_type_data(const ZAst *tree, NodeIndex node);
 uint32_t ast_array_init_item_size(const ZAst *tree, NodeIndex node);
 NodeIndex ast_array_init_item_at(const ZAst *tree, NodeIndex node, uint32_t i);
+uint32_t ast_array_init_items(const ZAst *tree, NodeIndex node, NodeIndex *out, uint32_t cap);
 NodeIndex ast_visit_one_child(const ZAst *tree, NodeIndex node);
+// NOTE: Children are in the same order as ast_visit
+NodeSpan ast_children(const ZAst *tree, NodeIndex node);
 NodeIndex ast_var_type(const ZAst *tree, NodeIndex node);
 NodeIndex ast_var_value(const ZAst *tree, NodeIndex node);
 
@@ -725,19 +964,28 @@ bool ast_fn_returns_inferred_error(const ZAst *tree, NodeIndex node);
 uint32_t ast_fn_param_count(const ZAst *tree, NodeIndex node);
 ParamData ast_fn_param_at(const ZAst *tree, NodeIndex node, uint32_t i);
 
+// NOTE: The bulk accessors copy at most cap items to out and return the
+// total number of items. If it is larger than cap call again with a
+// larger buffer.
+uint32_t ast_fn_params(const ZAst *tree, NodeIndex node, ParamData *out, uint32_t cap);
+
 // fn calls
 uint32_t ast_call_arg_count(const ZAst *tree, NodeIndex node);
 NodeIndex ast_call_arg_at(const ZAst *tree, NodeIndex node, uint32_t i);
+uint32_t ast_call_args(const ZAst *tree, NodeIndex node, NodeIndex *out, uint32_t cap);
 
 // struct init
 uint32_t ast_struct_init_field_count(const ZAst *tree, NodeIndex node);
 FieldInitData ast_struct_init_field_at(const ZAst *tree, NodeIndex node, uint32_t i);
+uint32_t ast_struct_init_fields(const ZAst *tree, NodeIndex node, FieldInitData *out, uint32_t cap);
 
 uint32_t ast_switch_case_size(const ZAst *tree, NodeIndex node);
 NodeIndex ast_switch_case_item_at(const ZAst *tree, NodeIndex node, uint32_t i);
+uint32_t ast_switch_case_items(const ZAst *tree, NodeIndex node, NodeIndex *out, uint32_t cap);
 
 uint32_t ast_for_input_count(const ZAst *tree, NodeIndex node);
 NodeIndex ast_for_input_at(const ZAst *tree, NodeIndex node, uint32_t i);
+uint32_t ast_for_inputs(const ZAst *tree, NodeIndex node, NodeIndex *out, uint32_t cap);
 
 // NOTE: These return INVALID_TOKEN on error 0 is a valid token
 TokenIndex ast_node_name_token(const ZAst *tree, NodeIndex node);
@@ -755,7 +1003,15 @@ SourceRange ast_node_range(const ZAst *tree, NodeIndex node);
 
 void ast_visit(const ZAst *tree, NodeIndex node, VisitorCallbackFn callback, void *data);
 
-bool is_zig_builtin_fn_name(const char *name);
+bool is_zig_builtin_fn_name(const char *name, uint32_t len);
+
+// Identifier tokens with the same name share an id from 0 to ast_ident_count
+uint32_t ast_token_ident_id(const ZAst *tree, TokenIndex token);
+uint32_t ast_ident_count(const ZAst *tree);
+SourceSlice ast_ident_slice(const ZAst *tree, uint32_t id);
+
+// Id of the builtin called by a builtin call node, or BuiltinFnId_invalid
+BuiltinFnId ast_builtin_id(const ZAst *tree, NodeIndex node);
 
 }
 
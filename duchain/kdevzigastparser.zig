@@ -13,66 +13,1618 @@ const INVALID_TOKEN = std.math.maxInt(TokenIndex);
 
 var gpa = std.heap.GeneralPurposeAllocator(.{}){};
 
+// Several parse jobs run at once and the gpa serializes every allocation
+// behind a single mutex so use the thread caching smp allocator unless
+// the leak checking of the gpa is wanted.
+fn globalAllocator() Allocator {
+    if (@import("builtin").mode == .Debug) {
+        return gpa.allocator();
+    }
+    return std.heap.smp_allocator;
+}
+
 // kdev-zig makes heavy use of fastTokenLocation which is really slow
-// so use a custom version
+// so use a custom version. The line of each token is computed once after
+// parsing so a lookup is a couple of array reads instead of a scan.
 const ZAst = struct {
     const Self = @This();
     ast: Ast,
+    // Offset of each '\n' (plus source.len if there is no trailing newline)
     line_offsets: []u32,
+    // Bit i is set if line i has a byte that is not ASCII
+    non_ascii_lines: []const u64,
+    // Line number of each token
+    token_lines: []u32,
+    // For each line that only contains a comment, the start offset of the
+    // run of comment lines ending at it, otherwise no_comment
+    comment_starts: []const u32,
+    // Direct children of node i are child_nodes[child_offsets[i]..child_offsets[i+1]]
+    // in the same order they are visited
+    child_offsets: []const u32,
+    child_nodes: []const NodeIndex,
+    // Parent of each node, the root is its own parent
+    parents: []const NodeIndex,
+    // First and last token of each node
+    first_tokens: []const TokenIndex,
+    last_tokens: []const TokenIndex,
+    // Start of the first and last token of each node
+    node_ranges: []const SourceRange,
+    // NodeKind of each node and NodeFlags computed from it
+    node_kinds: []const u8,
+    node_flags: []const u8,
+    // Interned id of each identifier token, tokens with the same name share
+    // an id. Other tokens are no_ident.
+    token_idents: []const u32,
+    // First token of each interned identifier
+    ident_tokens: []const TokenIndex,
+    // Raw arrays shared with C++ so the hot accessors do not need an ffi call
+    view: AstView,
+    // When created by reparse these are the root decls that differ from
+    // the previous ast, otherwise every root decl is considered changed
+    changed_decls: ?[]const NodeIndex = null,
+    // Bodies of the root fn and test decls that a reparse left in place
+    // while only other bodies changed, see diffRootDecls
+    unchanged_bodies: []const NodeIndex = &.{},
+    // Set when everything above was allocated from a pooled arena
+    arena: ?*std.heap.ArenaAllocator = null,
+    arena_key: u64 = 0,
+    // Set when the ast arrays and line offsets point into a mapped
+    // AstCache file instead of being allocated
+    mapping: ?[]align(std.heap.page_size_min) const u8 = null,
+    mode: ParseMode = .full,
 
     pub fn parse(allocator: Allocator, source: [:0]const u8) !ZAst {
-        var line_offsets = std.ArrayListUnmanaged(u32){};
-        defer line_offsets.deinit(allocator);
+        return parseWithMode(allocator, source, .full);
+    }
+
+    pub fn parseWithMode(allocator: Allocator, source: [:0]const u8, mode: ParseMode) !ZAst {
+        const lines = try scanLines(allocator, source);
+        errdefer {
+            allocator.free(lines.offsets);
+            allocator.free(lines.non_ascii);
+        }
+        var ast = switch (mode) {
+            .full => try Ast.parse(allocator, source, .zig),
+            .skeleton => blk: {
+                const skeleton = try allocator.dupeZ(u8, source);
+                defer allocator.free(skeleton);
+                blankFnBodies(skeleton);
+                // Everything outside of the bodies is unchanged so the
+                // tokens are also valid for the original source
+                var tree = try Ast.parse(allocator, skeleton, .zig);
+                tree.source = source;
+                break :blk tree;
+            },
+        };
+        errdefer ast.deinit(allocator);
+        var zast = try init(allocator, ast, lines);
+        zast.mode = mode;
+        return zast;
+    }
+
+    const LineIndex = struct {
+        offsets: []u32,
+        non_ascii: []u64,
+    };
+
+    // Find the line offsets and which lines are not plain ASCII in a
+    // single pass comparing a vector of bytes at a time
+    fn scanLines(allocator: Allocator, source: []const u8) !LineIndex {
+        var offsets = std.ArrayListUnmanaged(u32){};
+        defer offsets.deinit(allocator);
+        try offsets.ensureTotalCapacity(allocator, source.len / 32 + 1);
+        var non_ascii = std.ArrayListUnmanaged(u64){};
+        defer non_ascii.deinit(allocator);
+
+        const lanes = std.simd.suggestVectorLength(u8) orelse 16;
+        const Mask = std.meta.Int(.unsigned, lanes);
+        const newline: @Vector(lanes, u8) = @splat('\n');
+        const high: @Vector(lanes, u8) = @splat(0x80);
+        var line_non_ascii = false;
+        var i: usize = 0;
+        while (i + lanes <= source.len) : (i += lanes) {
+            const chunk: @Vector(lanes, u8) = source[i..][0..lanes].*;
+            var newlines: Mask = @bitCast(chunk == newline);
+            var highs: Mask = @bitCast(chunk >= high);
+            while (newlines != 0) : (newlines &= newlines - 1) {
+                const bit = @ctz(newlines);
+                const before = (@as(Mask, 1) << @intCast(bit)) - 1;
+                if (line_non_ascii or (highs & before) != 0) {
+                    try markLine(allocator, &non_ascii, offsets.items.len);
+                }
+                highs &= ~before;
+                line_non_ascii = false;
+                try offsets.append(allocator, @intCast(i + bit));
+            }
+            line_non_ascii = line_non_ascii or highs != 0;
+        }
+        for (source[i..], i..) |c, j| {
+            if (c == '\n') {
+                if (line_non_ascii) {
+                    try markLine(allocator, &non_ascii, offsets.items.len);
+                }
+                line_non_ascii = false;
+                try offsets.append(allocator, @intCast(j));
+            } else if (c >= 0x80) {
+                line_non_ascii = true;
+            }
+        }
+        // If the file does not end with a newline, add a final entry
+        const last_start = if (offsets.items.len == 0) 0 else offsets.items[offsets.items.len - 1] + 1;
+        if (last_start < source.len) {
+            if (line_non_ascii) {
+                try markLine(allocator, &non_ascii, offsets.items.len);
+            }
+            try offsets.append(allocator, @intCast(source.len));
+        }
+        const words = (offsets.items.len + 63) / 64;
+        if (non_ascii.items.len < words) {
+            try non_ascii.appendNTimes(allocator, 0, words - non_ascii.items.len);
+        }
+
+        const owned_offsets = try offsets.toOwnedSlice(allocator);
+        errdefer allocator.free(owned_offsets);
+        return LineIndex{
+            .offsets = owned_offsets,
+            .non_ascii = try non_ascii.toOwnedSlice(allocator),
+        };
+    }
 
-        const estimated_line_count = source.len / 80;
-        try line_offsets.ensureTotalCapacity(allocator, estimated_line_count);
+    fn markLine(allocator: Allocator, words: *std.ArrayListUnmanaged(u64), line: usize) !void {
+        const word = line / 64;
+        if (word >= words.items.len) {
+            try words.appendNTimes(allocator, 0, word + 1 - words.items.len);
+        }
+        words.items[word] |= @as(u64, 1) << @intCast(line % 64);
+    }
+
+    pub fn lineHasNonAscii(self: Self, line: u32) bool {
+        const word = line / 64;
+        return word < self.non_ascii_lines.len
+            and (self.non_ascii_lines[word] >> @intCast(line % 64)) & 1 != 0;
+    }
+
+    // Columns are in UTF-16 code units like KTextEditor uses. Only lines
+    // that are not plain ASCII need to be converted.
+    pub fn utf16Column(self: Self, line: u32, line_start: u32, byte_column: u32) u32 {
+        if (!self.lineHasNonAscii(line)) {
+            return byte_column;
+        }
+        var column: u32 = 0;
+        for (self.ast.source[line_start..][0..byte_column]) |c| {
+            // Continuation bytes do not start a code point and code
+            // points of 4 bytes are a surrogate pair
+            if ((c & 0xC0) != 0x80) {
+                column += 1;
+            }
+            if (c >= 0xF0) {
+                column += 1;
+            }
+        }
+        return column;
+    }
+
+    // Start of a token with the column in UTF-16 code units
+    pub fn tokenPosition(self: Self, token: TokenIndex) SourceLocation {
+        const loc = self.fastTokenLocation(token);
+        const line: u32 = @intCast(loc.line);
+        return SourceLocation{
+            .line = line,
+            .column = self.utf16Column(line, @intCast(loc.line_start), @intCast(loc.column)),
+        };
+    }
+
+    // Range of a token with the columns in UTF-16 code units
+    pub fn tokenRange(self: Self, token: TokenIndex) SourceRange {
+        const loc = self.fastTokenLocation(token);
+        const line: u32 = @intCast(loc.line);
+        const line_start: u32 = @intCast(loc.line_start);
+        const column: u32 = @intCast(loc.column);
+        const len: u32 = @intCast(self.ast.tokenSlice(token).len);
+        return SourceRange{
+            .start = SourceLocation{ .line = line, .column = self.utf16Column(line, line_start, column) },
+            .end = SourceLocation{ .line = line, .column = self.utf16Column(line, line_start, column + len) },
+        };
+    }
+
+    // Build the indexes of a parsed ast. The ast and line index are
+    // only owned by the result if this succeeds.
+    fn init(allocator: Allocator, ast: Ast, lines: LineIndex) !ZAst {
+        const line_offsets = lines.offsets;
+        // Tokens are ordered by start so the lines can be assigned
+        // in a single merge pass
+        const token_starts = ast.tokens.items(.start);
+        const token_lines = try allocator.alloc(u32, token_starts.len);
+        errdefer allocator.free(token_lines);
         {
+            const offsets = line_offsets;
+            var line: u32 = 0;
+            for (token_starts, token_lines) |start, *token_line| {
+                while (line < offsets.len and offsets[line] < start) {
+                    line += 1;
+                }
+                token_line.* = line;
+            }
+        }
 
-            var offset: u32 = 0;
-            while (std.mem.indexOfScalarPos(u8, source, offset, '\n')) |i| {
-                try line_offsets.append(allocator, @intCast(i));
-                offset = @as(u32, @intCast(i)) + 1;
+        const comment_starts = try buildCommentIndex(allocator, ast.source, line_offsets);
+        errdefer allocator.free(comment_starts);
+
+        var zast = ZAst{
+            .ast = ast,
+            .line_offsets = line_offsets,
+            .non_ascii_lines = lines.non_ascii,
+            .token_lines = token_lines,
+            .comment_starts = comment_starts,
+            .child_offsets = &.{},
+            .child_nodes = &.{},
+            .parents = &.{},
+            .first_tokens = &.{},
+            .last_tokens = &.{},
+            .node_ranges = &.{},
+            .node_kinds = &.{},
+            .node_flags = &.{},
+            .token_idents = &.{},
+            .ident_tokens = &.{},
+            .view = .{},
+        };
+        try zast.buildChildIndex(allocator);
+        errdefer {
+            allocator.free(zast.child_offsets);
+            allocator.free(zast.child_nodes);
+        }
+        try zast.buildPositionIndex(allocator);
+        errdefer {
+            allocator.free(zast.parents);
+            allocator.free(zast.first_tokens);
+            allocator.free(zast.last_tokens);
+            allocator.free(zast.node_ranges);
+        }
+        try zast.buildIdentIndex(allocator);
+        errdefer {
+            allocator.free(zast.token_idents);
+            allocator.free(zast.ident_tokens);
+        }
+        try zast.buildKindIndex(allocator);
+        zast.view = AstView.init(&zast);
+        return zast;
+    }
+
+    pub const no_ident = std.math.maxInt(u32);
+
+    fn buildKindIndex(self: *Self, allocator: Allocator) !void {
+        const node_count = self.ast.nodes.len;
+        const node_kinds = try allocator.alloc(u8, node_count);
+        errdefer allocator.free(node_kinds);
+        const node_flags = try allocator.alloc(u8, node_count);
+        errdefer allocator.free(node_flags);
+        for (node_kinds, 0..) |*kind, i| {
+            kind.* = @intFromEnum(nodeKind(self.ast, @intCast(i)));
+        }
+        const node_data = self.ast.nodes.items(.data);
+        const main_tokens = self.ast.nodes.items(.main_token);
+        for (node_flags, node_kinds, node_data) |*flags, kind, data| {
+            var result = NodeFlags{};
+            if (kind == @intFromEnum(NodeKind.VarDecl) and data.rhs != 0) {
+                // The var decl is named by its value, eg const Foo = struct {}
+                result.skip_decl = switch (@as(NodeKind, @enumFromInt(node_kinds[data.rhs]))) {
+                    .ContainerDecl, .ErrorDecl, .EnumDecl, .UnionDecl => true,
+                    .Call => BuiltinFnTable.lookup(self.ast.tokenSlice(main_tokens[data.rhs])) == .cImport,
+                    else => false,
+                };
             }
-            // If the file does not end with a newline, add a final entry
-            if (offset < source.len) {
-                try line_offsets.append(allocator, @intCast(source.len));
+            flags.* = @bitCast(result);
+        }
+        self.node_kinds = node_kinds;
+        self.node_flags = node_flags;
+    }
+
+    fn buildIdentIndex(self: *Self, allocator: Allocator) !void {
+        const token_tags = self.ast.tokens.items(.tag);
+        const token_idents = try allocator.alloc(u32, token_tags.len);
+        errdefer allocator.free(token_idents);
+        var ident_tokens = std.ArrayListUnmanaged(TokenIndex){};
+        defer ident_tokens.deinit(allocator);
+        var names = std.StringHashMapUnmanaged(u32){};
+        defer names.deinit(allocator);
+
+        for (token_tags, token_idents, 0..) |tag, *ident, i| {
+            if (tag != .identifier) {
+                ident.* = no_ident;
+                continue;
+            }
+            const token: TokenIndex = @intCast(i);
+            const entry = try names.getOrPut(allocator, self.ast.tokenSlice(token));
+            if (!entry.found_existing) {
+                entry.value_ptr.* = @intCast(ident_tokens.items.len);
+                try ident_tokens.append(allocator, token);
+            }
+            ident.* = entry.value_ptr.*;
+        }
+        self.token_idents = token_idents;
+        self.ident_tokens = try ident_tokens.toOwnedSlice(allocator);
+    }
+
+    pub const no_comment = std.math.maxInt(u32);
+
+    // Single pass over the lines. Only the leading whitespace of each line
+    // is inspected so this is much cheaper than tokenizing.
+    fn buildCommentIndex(allocator: Allocator, source: []const u8, line_offsets: []const u32) ![]const u32 {
+        const comment_starts = try allocator.alloc(u32, line_offsets.len);
+        var run_start: u32 = no_comment;
+        var line_start: u32 = 0;
+        for (line_offsets, comment_starts) |line_end, *comment_start| {
+            var i = line_start;
+            while (i < line_end and (source[i] == ' ' or source[i] == '\t')) {
+                i += 1;
+            }
+            const is_comment = i + 1 < line_end and source[i] == '/' and source[i + 1] == '/';
+            if (is_comment) {
+                if (run_start == no_comment) {
+                    run_start = line_start;
+                }
+            } else {
+                run_start = no_comment;
             }
+            comment_start.* = run_start;
+            line_start = line_end + 1;
         }
-        return ZAst{
-            .ast = try Ast.parse(allocator, source, .zig),
-            .line_offsets = try line_offsets.toOwnedSlice(allocator),
+        return comment_starts;
+    }
+
+    // The comment lines directly above the line the node starts on
+    pub fn nodeComment(self: Self, node: NodeIndex) ?[]const u8 {
+        const line = self.token_lines[self.first_tokens[node]];
+        if (line == 0) {
+            return null;
+        }
+        const comment_start = self.comment_starts[line - 1];
+        if (comment_start == no_comment) {
+            return null;
+        }
+        const comment_end = self.line_offsets[line - 1];
+        const comment = std.mem.trim(u8, self.ast.source[comment_start..comment_end], " \t\r\n");
+        if (comment.len < 3 or comment.len > 5000) {
+            return null;
+        }
+        return comment;
+    }
+
+    const ChildCollector = struct {
+        allocator: Allocator,
+        nodes: std.ArrayListUnmanaged(NodeIndex),
+        failed: bool = false,
+
+        pub fn callback(zast: *const ZAst, node: NodeIndex, parent: NodeIndex, self: *ChildCollector) VisitResult {
+            _ = zast;
+            _ = parent;
+            self.nodes.append(self.allocator, node) catch {
+                self.failed = true;
+                return .Break;
+            };
+            return .Continue;
+        }
+    };
+
+    fn buildChildIndex(self: *Self, allocator: Allocator) !void {
+        const node_count = self.ast.nodes.len;
+        const child_offsets = try allocator.alloc(u32, node_count + 1);
+        errdefer allocator.free(child_offsets);
+
+        // Every node except the root has exactly one parent
+        var collector = ChildCollector{
+            .allocator = allocator,
+            .nodes = try std.ArrayListUnmanaged(NodeIndex).initCapacity(allocator, node_count),
         };
+        errdefer collector.nodes.deinit(allocator);
+        for (0..node_count) |i| {
+            child_offsets[i] = @intCast(collector.nodes.items.len);
+            visit(self, @intCast(i), *ChildCollector, ChildCollector.callback, &collector);
+            if (collector.failed) {
+                return error.OutOfMemory;
+            }
+        }
+        child_offsets[node_count] = @intCast(collector.nodes.items.len);
+        self.child_nodes = try collector.nodes.toOwnedSlice(allocator);
+        self.child_offsets = child_offsets;
     }
 
-    pub fn fastTokenLocation(self: ZAst, token_index: TokenIndex) Ast.Location {
-        var loc = Ast.Location{
-            .line = 0,
-            .column = 0,
-            .line_start = 0,
-            .line_end = self.ast.source.len,
+    pub fn children(self: Self, node: NodeIndex) []const NodeIndex {
+        return self.child_nodes[self.child_offsets[node]..self.child_offsets[node + 1]];
+    }
+
+    const ByteRange = struct {
+        start: u32,
+        end: u32,
+    };
+
+    // Byte range of a root decl including its doc comments
+    fn declSourceRange(self: Self, decl: NodeIndex) ByteRange {
+        const token_tags = self.ast.tokens.items(.tag);
+        const token_starts = self.ast.tokens.items(.start);
+        var first = self.first_tokens[decl];
+        while (first > 0 and token_tags[first - 1] == .doc_comment) {
+            first -= 1;
+        }
+        const last = self.last_tokens[decl];
+        return ByteRange{
+            .start = token_starts[first],
+            .end = @intCast(token_starts[last] + self.ast.tokenSlice(last).len),
         };
-        const token_start = self.ast.tokens.items(.start)[token_index];
-        for (self.line_offsets) |i| {
-            if (i >= token_start) {
-                loc.column = token_start - loc.line_start;
-                loc.line_end = i;
-                break; // Went past
+    }
+
+    // Body of a fn or test decl, otherwise 0
+    fn declBody(self: Self, decl: NodeIndex) NodeIndex {
+        return switch (self.ast.nodes.items(.tag)[decl]) {
+            .fn_decl, .test_decl => self.ast.nodes.items(.data)[decl].rhs,
+            else => 0,
+        };
+    }
+
+    // Source of a fn or test decl up to its body including doc comments
+    fn declHeader(self: Self, decl: NodeIndex) []const u8 {
+        const start = self.declSourceRange(decl).start;
+        const body_start = self.ast.tokens.items(.start)[self.first_tokens[self.declBody(decl)]];
+        return self.ast.source[start..body_start];
+    }
+
+    // The type of a fn returning a type or with an inferred error set
+    // depends on its body
+    fn bodyDeterminesType(self: Self, decl: NodeIndex) bool {
+        if (self.ast.nodes.items(.tag)[decl] != .fn_decl) {
+            return false;
+        }
+        var buf: [1]Ast.Node.Index = undefined;
+        const proto = self.ast.fullFnProto(&buf, decl) orelse return true;
+        const first = self.first_tokens[proto.ast.return_type];
+        if (self.ast.tokens.items(.tag)[first - 1] == .bang) {
+            return true;
+        }
+        return self.ast.nodes.items(.tag)[proto.ast.return_type] == .identifier
+            and isTokenSliceEql(self.ast, first, "type");
+    }
+
+    const DeclKey = struct {
+        start: u32,
+        hash: u64,
+    };
+
+    // Find the root decls that are not identical to a root decl of the
+    // old ast after the range edit_start..edit_end of the old source
+    // was replaced.
+    fn diffRootDecls(self: *Self, allocator: Allocator, old: *const ZAst, edit_start: u32, edit_end: u32) !void {
+        const delta = @as(i64, @intCast(self.ast.source.len)) - @as(i64, @intCast(old.ast.source.len));
+        var unchanged = std.AutoHashMap(DeclKey, void).init(allocator);
+        defer unchanged.deinit();
+        for (old.ast.rootDecls()) |decl| {
+            const r = old.declSourceRange(decl);
+            const hash = std.hash.Wyhash.hash(0, old.ast.source[r.start..r.end]);
+            if (r.end <= edit_start) {
+                try unchanged.put(.{ .start = r.start, .hash = hash }, {});
+            } else if (r.start >= edit_end) {
+                const start: u32 = @intCast(@as(i64, r.start) + delta);
+                try unchanged.put(.{ .start = start, .hash = hash }, {});
+            }
+        }
+
+        var changed = std.ArrayListUnmanaged(NodeIndex){};
+        errdefer changed.deinit(allocator);
+        for (self.ast.rootDecls()) |decl| {
+            const r = self.declSourceRange(decl);
+            const hash = std.hash.Wyhash.hash(0, self.ast.source[r.start..r.end]);
+            if (!unchanged.contains(.{ .start = r.start, .hash = hash })) {
+                try changed.append(allocator, decl);
             }
-            loc.line += 1;
-            loc.line_start = i + 1;
         }
-        return loc;
+        self.changed_decls = try changed.toOwnedSlice(allocator);
+        self.unchanged_bodies = try self.findUnchangedBodies(allocator, old);
     }
 
+    // The uses in a body only depend on the declarations outside of it and
+    // in it. When every changed root decl is a fn or test with the same
+    // header, nothing outside of the bodies changed so the other bodies
+    // that did not move still have the same uses.
+    fn findUnchangedBodies(self: Self, allocator: Allocator, old: *const ZAst) ![]const NodeIndex {
+        const decls = self.ast.rootDecls();
+        const old_decls = old.ast.rootDecls();
+        if (self.ast.errors.len > 0 or old.ast.errors.len > 0 or self.mode != .full
+                or old.mode != .full or decls.len != old_decls.len) {
+            return &.{};
+        }
+        // The edit is a single range so with the same number of decls
+        // the ones before and after it keep their index
+        const changed = self.changed_decls orelse return &.{};
+        var next: usize = 0;
+        for (changed) |decl| {
+            const i = std.mem.indexOfScalarPos(NodeIndex, decls, next, decl) orelse return &.{};
+            const old_decl = old_decls[i];
+            if (self.declBody(decl) == 0 or old.declBody(old_decl) == 0
+                    or self.bodyDeterminesType(decl)
+                    or !std.mem.eql(u8, self.declHeader(decl), old.declHeader(old_decl))) {
+                return &.{};
+            }
+            next = i + 1;
+        }
+
+        var bodies = std.ArrayListUnmanaged(NodeIndex){};
+        errdefer bodies.deinit(allocator);
+        var remaining = changed;
+        for (decls, old_decls) |decl, old_decl| {
+            if (remaining.len > 0 and remaining[0] == decl) {
+                remaining = remaining[1..];
+                continue;
+            }
+            const body = self.declBody(decl);
+            const old_body = old.declBody(old_decl);
+            if (body == 0 or old_body == 0) {
+                continue;
+            }
+            // Unchanged decls have the same source so if the body starts at
+            // the same line and column everything in it is where it was
+            const start = self.node_ranges[body].start;
+            const old_start = old.node_ranges[old_body].start;
+            if (start.line == old_start.line and start.column == old_start.column) {
+                try bodies.append(allocator, body);
+            }
+        }
+        return try bodies.toOwnedSlice(allocator);
+    }
+
+    // Requires the child index
+    fn buildPositionIndex(self: *Self, allocator: Allocator) !void {
+        const node_count = self.ast.nodes.len;
+        const parents = try allocator.alloc(NodeIndex, node_count);
+        errdefer allocator.free(parents);
+        const first_tokens = try allocator.alloc(TokenIndex, node_count);
+        errdefer allocator.free(first_tokens);
+        const last_tokens = try allocator.alloc(TokenIndex, node_count);
+        errdefer allocator.free(last_tokens);
+        const node_ranges = try allocator.alloc(SourceRange, node_count);
+        errdefer allocator.free(node_ranges);
+        const queue = try allocator.alloc(NodeIndex, node_count);
+        defer allocator.free(queue);
+        var reached = try std.DynamicBitSetUnmanaged.initEmpty(allocator, node_count);
+        defer reached.deinit(allocator);
+
+        // Nodes that were unreserved after a parse error are not reachable
+        // from the root, they keep the root as parent
+        @memset(parents, 0);
+        @memset(first_tokens, 0);
+        @memset(last_tokens, 0);
+        @memset(node_ranges, SourceRange{});
+
+        // Breadth first from the root
+        queue[0] = 0;
+        reached.set(0);
+        var head: usize = 0;
+        var tail: usize = 1;
+        while (head < tail) : (head += 1) {
+            const node = queue[head];
+            for (self.children(node)) |child| {
+                if (child >= node_count or reached.isSet(child)) {
+                    continue;
+                }
+                parents[child] = node;
+                reached.set(child);
+                queue[tail] = child;
+                tail += 1;
+            }
+            first_tokens[node] = self.ast.firstToken(node);
+            last_tokens[node] = self.ast.lastToken(node);
+            node_ranges[node] = SourceRange{
+                .start = self.tokenPosition(first_tokens[node]),
+                .end = self.tokenPosition(last_tokens[node]),
+            };
+        }
+
+        self.parents = parents;
+        self.first_tokens = first_tokens;
+        self.last_tokens = last_tokens;
+        self.node_ranges = node_ranges;
+    }
+
+    pub fn fastTokenLocation(self: ZAst, token_index: TokenIndex) Ast.Location {
+        const token_start = self.ast.tokens.items(.start)[token_index];
+        const line = self.token_lines[token_index];
+        const line_start = if (line == 0) 0 else self.line_offsets[line - 1] + 1;
+        return Ast.Location{
+            .line = line,
+            .column = token_start - line_start,
+            .line_start = line_start,
+            .line_end = if (line < self.line_offsets.len)
+                self.line_offsets[line]
+            else
+                self.ast.source.len,
+        };
+    }
 
     pub fn deinit(self: *ZAst, allocator: Allocator) void {
-        self.ast.deinit(allocator);
-        allocator.free(self.line_offsets);
+        if (self.mapping) |mapping| {
+            std.posix.munmap(mapping);
+        } else {
+            self.ast.deinit(allocator);
+            allocator.free(self.line_offsets);
+            allocator.free(self.non_ascii_lines);
+        }
+        allocator.free(self.token_lines);
+        allocator.free(self.comment_starts);
+        allocator.free(self.child_offsets);
+        allocator.free(self.child_nodes);
+        allocator.free(self.parents);
+        allocator.free(self.first_tokens);
+        allocator.free(self.last_tokens);
+        allocator.free(self.node_ranges);
+        allocator.free(self.token_idents);
+        allocator.free(self.ident_tokens);
+        allocator.free(self.node_kinds);
+        allocator.free(self.node_flags);
         self.* = undefined;
     }
 
 };
 
+// On-disk copy of the token, node and extra data arrays and the line offsets
+// of a parsed ast so files that rarely change (eg the std lib) can be mapped
+// instead of tokenized and parsed again. The arrays are stored in the memory
+// layout of this build so the key includes the zig version of the parser.
+const AstCache = struct {
+    const magic = "KDEVZAST".*;
+    const format_version: u32 = 3;
+    const section_align = 16;
+    const section_count = 8;
+
+    const Header = extern struct {
+        magic: [8]u8 = magic,
+        format_version: u32 = format_version,
+        source_len: u32,
+        key: u64,
+        // Of everything after the header
+        payload_hash: u64,
+        token_count: u32,
+        node_count: u32,
+        extra_count: u32,
+        line_count: u32,
+    };
+
+    // Depends on the parser version, the parse mode and the source
+    pub fn keyFor(source: []const u8, mode: ParseMode) u64 {
+        const seed = comptime std.hash.Wyhash.hash(format_version, @import("builtin").zig_version_string);
+        return std.hash.Wyhash.hash(seed +% @intFromEnum(mode), source);
+    }
+
+    pub fn payloadHash(payload: []const u8) u64 {
+        return std.hash.Wyhash.hash(0, payload);
+    }
+
+    fn sectionSizes(header: Header) [section_count]usize {
+        const token_count: usize = header.token_count;
+        const node_count: usize = header.node_count;
+        return .{
+            token_count * @sizeOf(std.zig.Token.Tag),
+            token_count * @sizeOf(Ast.ByteOffset),
+            node_count * @sizeOf(Ast.Node.Tag),
+            node_count * @sizeOf(Ast.TokenIndex),
+            node_count * @sizeOf(Ast.Node.Data),
+            @as(usize, header.extra_count) * @sizeOf(Ast.Node.Index),
+            @as(usize, header.line_count) * @sizeOf(u32),
+            ((@as(usize, header.line_count) + 63) / 64) * @sizeOf(u64),
+        };
+    }
+
+    // Trees with errors are never written. The key is keyFor of the source
+    // and mode of the tree.
+    pub fn serialize(zast: *const ZAst, key: u64, writer: anytype) !void {
+        if (zast.ast.errors.len > 0) {
+            return error.AstHasErrors;
+        }
+        const ast = zast.ast;
+        const sections = [section_count][]const u8{
+            std.mem.sliceAsBytes(ast.tokens.items(.tag)),
+            std.mem.sliceAsBytes(ast.tokens.items(.start)),
+            std.mem.sliceAsBytes(ast.nodes.items(.tag)),
+            std.mem.sliceAsBytes(ast.nodes.items(.main_token)),
+            std.mem.sliceAsBytes(ast.nodes.items(.data)),
+            std.mem.sliceAsBytes(ast.extra_data),
+            std.mem.sliceAsBytes(zast.line_offsets),
+            std.mem.sliceAsBytes(zast.non_ascii_lines),
+        };
+        const zeros = [_]u8{0} ** section_align;
+        var hasher = std.hash.Wyhash.init(0);
+        var offset: usize = @sizeOf(Header);
+        for (sections) |bytes| {
+            const padding = std.mem.alignForward(usize, offset, section_align) - offset;
+            hasher.update(zeros[0..padding]);
+            hasher.update(bytes);
+            offset += padding + bytes.len;
+        }
+        const header = Header{
+            .source_len = @intCast(ast.source.len),
+            .key = key,
+            .payload_hash = hasher.final(),
+            .token_count = @intCast(ast.tokens.len),
+            .node_count = @intCast(ast.nodes.len),
+            .extra_count = @intCast(ast.extra_data.len),
+            .line_count = @intCast(zast.line_offsets.len),
+        };
+        try writer.writeAll(std.mem.asBytes(&header));
+        offset = @sizeOf(Header);
+        for (sections) |bytes| {
+            const padding = std.mem.alignForward(usize, offset, section_align) - offset;
+            try writer.writeByteNTimes(0, padding);
+            try writer.writeAll(bytes);
+            offset += padding + bytes.len;
+        }
+    }
+
+    // Contents of the cache file so it can be written elsewhere
+    pub fn encode(allocator: Allocator, zast: *const ZAst, key: u64) ![]u8 {
+        var data = std.ArrayList(u8).init(allocator);
+        errdefer data.deinit();
+        try serialize(zast, key, data.writer());
+        return data.toOwnedSlice();
+    }
+
+    pub fn write(zast: *const ZAst, dir: std.fs.Dir, path: []const u8) !void {
+        // Written to a temp file and renamed so a reader never maps
+        // a partially written file
+        var file = try dir.atomicFile(path, .{ .make_path = true });
+        defer file.deinit();
+        var buffered = std.io.bufferedWriter(file.file.writer());
+        try serialize(zast, keyFor(zast.ast.source, zast.mode), buffered.writer());
+        try buffered.flush();
+        try file.finish();
+    }
+
+    // Map the cache file written for source, the key is keyFor of the source
+    // and mode. The ast arrays point into the mapping which is unmapped when
+    // the ast is freed.
+    pub fn load(allocator: Allocator, dir: std.fs.Dir, path: []const u8, source: [:0]const u8, mode: ParseMode, key: u64) !ZAst {
+        const file = try dir.openFile(path, .{});
+        defer file.close();
+        const size = try file.getEndPos();
+        if (size < @sizeOf(Header)) {
+            return error.InvalidAstCache;
+        }
+        const mapping = try std.posix.mmap(null, size, std.posix.PROT.READ, .{ .TYPE = .PRIVATE }, file.handle, 0);
+        errdefer std.posix.munmap(mapping);
+
+        const header: *const Header = @ptrCast(mapping.ptr);
+        if (!std.mem.eql(u8, &header.magic, &magic)
+            or header.format_version != format_version
+            or header.source_len != source.len
+            or header.key != key) {
+            return error.StaleAstCache;
+        }
+        // The key only covers the source, a damaged file is caught here
+        if (payloadHash(mapping[@sizeOf(Header)..]) != header.payload_hash) {
+            return error.InvalidAstCache;
+        }
+        var sections: [section_count][*]u8 = undefined;
+        var offset: usize = @sizeOf(Header);
+        for (sectionSizes(header.*), &sections) |section_size, *section| {
+            offset = std.mem.alignForward(usize, offset, section_align);
+            if (offset + section_size > size) {
+                return error.InvalidAstCache;
+            }
+            // The mapping is read only but nothing writes to a parsed ast
+            section.* = mapping.ptr + offset;
+            offset += section_size;
+        }
+
+        var tokens = Ast.TokenList.Slice{ .ptrs = undefined, .len = header.token_count, .capacity = header.token_count };
+        tokens.ptrs[@intFromEnum(Ast.TokenList.Field.tag)] = sections[0];
+        tokens.ptrs[@intFromEnum(Ast.TokenList.Field.start)] = sections[1];
+        var nodes = Ast.NodeList.Slice{ .ptrs = undefined, .len = header.node_count, .capacity = header.node_count };
+        nodes.ptrs[@intFromEnum(Ast.NodeList.Field.tag)] = sections[2];
+        nodes.ptrs[@intFromEnum(Ast.NodeList.Field.main_token)] = sections[3];
+        nodes.ptrs[@intFromEnum(Ast.NodeList.Field.data)] = sections[4];
+        const extra_data: [*]Ast.Node.Index = @ptrCast(@alignCast(sections[5]));
+        const line_offsets: [*]u32 = @ptrCast(@alignCast(sections[6]));
+        const non_ascii_lines: [*]u64 = @ptrCast(@alignCast(sections[7]));
+        if (!validTags(std.zig.Token.Tag, sections[0][0..header.token_count])
+            or !validTags(Ast.Node.Tag, sections[2][0..header.node_count])
+            or !validIndexes(header.*, tokens, nodes, extra_data[0..header.extra_count], line_offsets[0..header.line_count])) {
+            return error.InvalidAstCache;
+        }
+
+        const ast = Ast{
+            .source = source,
+            .tokens = tokens,
+            .nodes = nodes,
+            .extra_data = extra_data[0..header.extra_count],
+            .errors = &.{},
+        };
+        var zast = try ZAst.init(allocator, ast, .{
+            .offsets = line_offsets[0..header.line_count],
+            .non_ascii = non_ascii_lines[0..(header.line_count + 63) / 64],
+        });
+        zast.mapping = mapping;
+        zast.mode = mode;
+        return zast;
+    }
+
+    // A tag outside of the enum would be undefined behavior in a switch.
+    // Tags are numbered from 0 so any value below the field count is valid.
+    fn validTags(comptime T: type, bytes: []const u8) bool {
+        comptime std.debug.assert(@sizeOf(T) == 1);
+        const fields = @typeInfo(T).@"enum".fields;
+        inline for (fields, 0..) |field, i| {
+            comptime std.debug.assert(field.value == i);
+        }
+        for (bytes) |value| {
+            if (value >= fields.len) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Second line of defense after the payload hash, which only catches
+    // accidental damage. Data and extra values are node, token or extra
+    // indexes depending on the tag so they can only be checked against the
+    // largest, except the input count and else flag packed into the rhs
+    // of a for. Main tokens are always token indexes.
+    fn validIndexes(header: Header, tokens: Ast.TokenList.Slice, nodes: Ast.NodeList.Slice, extra_data: []const Ast.Node.Index, line_offsets: []const u32) bool {
+        if (header.token_count == 0 or header.node_count == 0) {
+            return false;
+        }
+        for (tokens.items(.start)) |start| {
+            if (start > header.source_len) {
+                return false;
+            }
+        }
+        for (line_offsets) |offset| {
+            if (offset > header.source_len) {
+                return false;
+            }
+        }
+        // A range of extra data ends one past the last item
+        const max_index = @max(header.token_count, header.node_count, header.extra_count + 1);
+        for (nodes.items(.tag), nodes.items(.main_token), nodes.items(.data)) |tag, main_token, data| {
+            if (main_token >= header.token_count or data.lhs >= max_index) {
+                return false;
+            }
+            const rhs = if (tag == .@"for") @as(Ast.Node.For, @bitCast(data.rhs)).inputs else data.rhs;
+            if (rhs >= max_index) {
+                return false;
+            }
+        }
+        for (extra_data) |value| {
+            if (value >= max_index) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+test "ast-cache" {
+    const allocator = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+
+    const source = try generateSource(allocator, 1000);
+    defer allocator.free(source);
+    var parsed = try ZAst.parse(allocator, source);
+    defer parsed.deinit(allocator);
+    try AstCache.write(&parsed, tmp.dir, "cache/a.zast");
+
+    var mapped = try AstCache.load(allocator, tmp.dir, "cache/a.zast", source, .full, AstCache.keyFor(source, .full));
+    defer mapped.deinit(allocator);
+    try std.testing.expect(mapped.mapping != null);
+    try std.testing.expectEqualSlices(u32, parsed.line_offsets, mapped.line_offsets);
+    try std.testing.expectEqualSlices(u64, parsed.non_ascii_lines, mapped.non_ascii_lines);
+    try std.testing.expectEqualSlices(u32, parsed.ast.extra_data, mapped.ast.extra_data);
+    try std.testing.expectEqualSlices(u32, parsed.ast.tokens.items(.start), mapped.ast.tokens.items(.start));
+    try std.testing.expectEqualSlices(u32, parsed.ast.nodes.items(.main_token), mapped.ast.nodes.items(.main_token));
+    try std.testing.expectEqualSlices(u8, parsed.node_kinds, mapped.node_kinds);
+    try std.testing.expectEqualSlices(NodeIndex, parsed.parents, mapped.parents);
+    for (parsed.ast.rootDecls(), mapped.ast.rootDecls()) |a, b| {
+        try std.testing.expectEqual(parsed.ast.nodes.items(.tag)[a], mapped.ast.nodes.items(.tag)[b]);
+        try std.testing.expectEqualStrings(parsed.ast.getNodeSource(a), mapped.ast.getNodeSource(b));
+    }
+
+    // Any change to the source invalidates it
+    const changed = try allocator.dupeZ(u8, source);
+    defer allocator.free(changed);
+    changed[0] +%= 1;
+    try std.testing.expectError(error.StaleAstCache, AstCache.load(allocator, tmp.dir, "cache/a.zast", changed, .full, AstCache.keyFor(changed, .full)));
+    // So does asking for another mode
+    try std.testing.expectError(error.StaleAstCache, AstCache.load(allocator, tmp.dir, "cache/a.zast", source, .skeleton, AstCache.keyFor(source, .skeleton)));
+
+    // The encoded contents are what is written to the file
+    const encoded = try AstCache.encode(allocator, &parsed, AstCache.keyFor(source, .full));
+    defer allocator.free(encoded);
+    const written = try tmp.dir.readFileAlloc(allocator, "cache/a.zast", encoded.len + 1);
+    defer allocator.free(written);
+    try std.testing.expectEqualSlices(u8, written, encoded);
+
+    // A damaged file is rejected instead of trusted
+    const damaged = try allocator.dupe(u8, encoded);
+    defer allocator.free(damaged);
+    const header = std.mem.bytesToValue(AstCache.Header, damaged[0..@sizeOf(AstCache.Header)]);
+    var offset: usize = @sizeOf(AstCache.Header);
+    for (AstCache.sectionSizes(header)[0..3]) |size| {
+        offset = std.mem.alignForward(usize, offset, AstCache.section_align) + size;
+    }
+    // Main token of the root
+    offset = std.mem.alignForward(usize, offset, AstCache.section_align);
+    @memset(damaged[offset..][0..@sizeOf(Ast.TokenIndex)], 0xff);
+    try tmp.dir.writeFile(.{ .sub_path = "cache/b.zast", .data = damaged });
+    try std.testing.expectError(error.InvalidAstCache, AstCache.load(allocator, tmp.dir, "cache/b.zast", source, .full, AstCache.keyFor(source, .full)));
+
+    // A node index past the nodes that is still below the token count
+    // fits every index bound, only the payload hash rejects it
+    @memcpy(damaged, encoded);
+    const decl = parsed.ast.rootDecls()[0];
+    try std.testing.expectEqual(Tag.simple_var_decl, parsed.ast.nodes.items(.tag)[decl]);
+    try std.testing.expect(header.node_count < header.token_count);
+    offset = @sizeOf(AstCache.Header);
+    for (AstCache.sectionSizes(header)[0..4]) |size| {
+        offset = std.mem.alignForward(usize, offset, AstCache.section_align) + size;
+    }
+    offset = std.mem.alignForward(usize, offset, AstCache.section_align);
+    const init_offset = offset + decl * @sizeOf(Ast.Node.Data) + @offsetOf(Ast.Node.Data, "rhs");
+    std.mem.writeInt(u32, damaged[init_offset..][0..4], header.node_count, .little);
+    try tmp.dir.writeFile(.{ .sub_path = "cache/b.zast", .data = damaged });
+    try std.testing.expectError(error.InvalidAstCache, AstCache.load(allocator, tmp.dir, "cache/b.zast", source, .full, AstCache.keyFor(source, .full)));
+
+    // A tag outside of the enum is rejected even if the hash matches
+    @memcpy(damaged, encoded);
+    offset = @sizeOf(AstCache.Header);
+    for (AstCache.sectionSizes(header)[0..2]) |size| {
+        offset = std.mem.alignForward(usize, offset, AstCache.section_align) + size;
+    }
+    offset = std.mem.alignForward(usize, offset, AstCache.section_align);
+    damaged[offset + decl] = 0xff;
+    var rehashed = header;
+    rehashed.payload_hash = AstCache.payloadHash(damaged[@sizeOf(AstCache.Header)..]);
+    @memcpy(damaged[0..@sizeOf(AstCache.Header)], std.mem.asBytes(&rehashed));
+    try tmp.dir.writeFile(.{ .sub_path = "cache/b.zast", .data = damaged });
+    try std.testing.expectError(error.InvalidAstCache, AstCache.load(allocator, tmp.dir, "cache/b.zast", source, .full, AstCache.keyFor(source, .full)));
+
+    // The rhs of a for is not an index
+    const for_source = "test { for (a, b) |x, y| { _ = x; _ = y; } else {} }";
+    var for_parsed = try ZAst.parse(allocator, for_source);
+    defer for_parsed.deinit(allocator);
+    try AstCache.write(&for_parsed, tmp.dir, "cache/c.zast");
+    var for_mapped = try AstCache.load(allocator, tmp.dir, "cache/c.zast", for_source, .full, AstCache.keyFor(for_source, .full));
+    defer for_mapped.deinit(allocator);
+}
+
+// Each parsed ast allocates from its own arena. When the ast is destroyed the
+// arena is reset but keeps its capacity and goes back into a small pool keyed by
+// the document, so reparsing the same file reuses the previous allocation.
+const ArenaPool = struct {
+    const Self = @This();
+    const max_pooled = 16;
+
+    const Entry = struct {
+        key: u64,
+        arena: *std.heap.ArenaAllocator,
+        capacity: usize,
+    };
+
+    // If null the global allocator is used
+    backing: ?Allocator = null,
+    // Do not hold on to more than this across all pooled arenas
+    max_retained_bytes: usize = 64 * 1024 * 1024,
+    mutex: std.Thread.Mutex = .{},
+    entries: std.BoundedArray(Entry, max_pooled) = .{},
+    // Capacity of the pooled arenas
+    retained_bytes: usize = 0,
+
+    pub fn backingAllocator(self: *const Self) Allocator {
+        return self.backing orelse globalAllocator();
+    }
+
+    pub fn keyFor(name: []const u8) u64 {
+        return std.hash.Wyhash.hash(0, name);
+    }
+
+    pub fn acquire(self: *Self, key: u64) !*std.heap.ArenaAllocator {
+        {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            const entries = self.entries.slice();
+            if (entries.len > 0) {
+                // Prefer the arena last used for this document since it
+                // is already sized for it
+                var i: usize = entries.len - 1;
+                for (entries, 0..) |entry, j| {
+                    if (entry.key == key) {
+                        i = j;
+                        break;
+                    }
+                }
+                const entry = self.entries.swapRemove(i);
+                self.retained_bytes -= entry.capacity;
+                return entry.arena;
+            }
+        }
+        const allocator = self.backingAllocator();
+        const arena = try allocator.create(std.heap.ArenaAllocator);
+        arena.* = std.heap.ArenaAllocator.init(allocator);
+        return arena;
+    }
+
+    pub fn release(self: *Self, key: u64, arena: *std.heap.ArenaAllocator) void {
+        {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            // The arena only keeps what is left of the budget, if nothing
+            // is left it is freed
+            const budget = self.max_retained_bytes -| self.retained_bytes;
+            if (self.entries.len < max_pooled and budget > 0) {
+                _ = arena.reset(.{ .retain_with_limit = budget });
+                const capacity = arena.queryCapacity();
+                self.retained_bytes += capacity;
+                self.entries.appendAssumeCapacity(.{ .key = key, .arena = arena, .capacity = capacity });
+                return;
+            }
+        }
+        arena.deinit();
+        self.backingAllocator().destroy(arena);
+    }
+
+    pub fn deinit(self: *Self) void {
+        for (self.entries.slice()) |entry| {
+            entry.arena.deinit();
+            self.backingAllocator().destroy(entry.arena);
+        }
+        self.entries.len = 0;
+        self.retained_bytes = 0;
+    }
+
+    // Parse into a pooled arena. The returned ast must be destroyed
+    // with destroy.
+    pub fn parse(self: *Self, name: []const u8, source: [:0]const u8) !*ZAst {
+        return self.parseKeyed(keyFor(name), source.ptr, source.len, true, .full);
+    }
+
+    // Parse the new source of a document after the range edit_start..edit_end
+    // of the old source was replaced and find which root decls changed.
+    pub fn reparse(self: *Self, old: *const ZAst, edit_start: u32, edit_end: u32, source_ptr: [*]const u8, source_len: usize, is_terminated: bool) !*ZAst {
+        if (edit_start > edit_end or edit_end > old.ast.source.len) {
+            return error.InvalidEditRange;
+        }
+        const zast = try self.parseKeyed(old.arena_key, source_ptr, source_len, is_terminated, old.mode);
+        errdefer self.destroy(zast);
+        try zast.diffRootDecls(zast.arena.?.allocator(), old, edit_start, edit_end);
+        return zast;
+    }
+
+    fn parseKeyed(self: *Self, key: u64, source_ptr: [*]const u8, source_len: usize, is_terminated: bool, mode: ParseMode) !*ZAst {
+        const allocator = self.backingAllocator();
+        const zast = try allocator.create(ZAst);
+        errdefer allocator.destroy(zast);
+        const arena = try self.acquire(key);
+        errdefer self.release(key, arena);
+        // The ast only references the source so it must outlive it
+        const source = try terminatedSource(arena.allocator(), source_ptr, source_len, is_terminated);
+        zast.* = try ZAst.parseWithMode(arena.allocator(), source, mode);
+        zast.arena = arena;
+        zast.arena_key = key;
+        return zast;
+    }
+
+    // Map a cached ast of the source into a pooled arena, see AstCache
+    pub fn load(self: *Self, name: []const u8, path: []const u8, source_ptr: [*]const u8, source_len: usize, is_terminated: bool, mode: ParseMode, cache_key: u64) !*ZAst {
+        const key = keyFor(name);
+        const allocator = self.backingAllocator();
+        const zast = try allocator.create(ZAst);
+        errdefer allocator.destroy(zast);
+        const arena = try self.acquire(key);
+        errdefer self.release(key, arena);
+        const source = try terminatedSource(arena.allocator(), source_ptr, source_len, is_terminated);
+        zast.* = try AstCache.load(arena.allocator(), std.fs.cwd(), path, source, mode, cache_key);
+        zast.arena = arena;
+        zast.arena_key = key;
+        return zast;
+    }
+
+    pub fn destroy(self: *Self, zast: *ZAst) void {
+        if (zast.arena) |arena| {
+            if (zast.mapping) |mapping| {
+                std.posix.munmap(mapping);
+            }
+            // Everything is freed at once when the arena is reset
+            self.release(zast.arena_key, arena);
+        } else {
+            zast.deinit(self.backingAllocator());
+        }
+        self.backingAllocator().destroy(zast);
+    }
+};
+
+var arena_pool = ArenaPool{};
+
+test "arena-pool" {
+    // Reparsing a document should reuse the pooled arena instead of
+    // going back to the backing allocator
+    var counter = std.testing.FailingAllocator.init(std.testing.allocator, .{});
+    var pool = ArenaPool{ .backing = counter.allocator() };
+    defer pool.deinit();
+
+    const source = try generateSource(std.testing.allocator, 1000);
+    defer std.testing.allocator.free(source);
+
+    var first_allocations: usize = 0;
+    for (0..3) |i| {
+        const start = counter.allocations;
+        const zast = try pool.parse("a.zig", source);
+        pool.destroy(zast);
+        const allocations = counter.allocations - start;
+        if (i == 0) {
+            first_allocations = allocations;
+        } else {
+            try std.testing.expect(allocations < first_allocations);
+        }
+    }
+    try std.testing.expectEqual(@as(usize, 1), pool.entries.len);
+}
+
+test "arena-pool-retained" {
+    // The pooled arenas together never keep more than the cap
+    var pool = ArenaPool{ .backing = std.testing.allocator, .max_retained_bytes = 64 * 1024 };
+    defer pool.deinit();
+
+    const source = try generateSource(std.testing.allocator, 1000);
+    defer std.testing.allocator.free(source);
+    const a = try pool.parse("a.zig", source);
+    const b = try pool.parse("b.zig", source);
+    pool.destroy(a);
+    try std.testing.expectEqual(@as(usize, 1), pool.entries.len);
+    try std.testing.expect(pool.retained_bytes > 0);
+    try std.testing.expect(pool.retained_bytes <= pool.max_retained_bytes);
+    pool.destroy(b);
+    try std.testing.expect(pool.retained_bytes <= pool.max_retained_bytes);
+
+    // Taking an arena out gives its capacity back to the budget
+    const before = pool.retained_bytes;
+    const c = try pool.parse("a.zig", source);
+    try std.testing.expect(pool.retained_bytes < before);
+    pool.destroy(c);
+    try std.testing.expect(pool.retained_bytes <= pool.max_retained_bytes);
+}
+
+fn expectDeclNames(zast: *ZAst, decls: []const NodeIndex, expected: []const []const u8) !void {
+    try std.testing.expectEqual(expected.len, decls.len);
+    for (decls, expected) |decl, name| {
+        const name_token = ast_node_name_token(zast, decl);
+        try std.testing.expectEqualStrings(name, zast.ast.tokenSlice(name_token));
+    }
+}
+
+// Check the changed root decls and the fns whose bodies were kept
+fn testReparse(old_source: [:0]const u8, edit_start: u32, edit_end: u32, new_source: [:0]const u8, changed: []const []const u8, kept: []const []const u8) !void {
+    var pool = ArenaPool{ .backing = std.testing.allocator };
+    defer pool.deinit();
+    const old = try pool.parse("reparse.zig", old_source);
+    defer pool.destroy(old);
+    const zast = try pool.reparse(old, edit_start, edit_end, new_source.ptr, new_source.len, true);
+    defer pool.destroy(zast);
+    try expectDeclNames(zast, zast.changed_decls.?, changed);
+    var owners: [8]NodeIndex = undefined;
+    for (zast.unchanged_bodies, 0..) |body, i| {
+        owners[i] = zast.parents[body];
+    }
+    try expectDeclNames(zast, owners[0..zast.unchanged_bodies.len], kept);
+}
+
+test "reparse" {
+    const source =
+        \\const a = 1;
+        \\/// Doc
+        \\pub fn b() void {}
+        \\const c = 2;
+    ;
+    // Edit in the middle decl
+    try testReparse(source, 38, 38,
+        \\const a = 1;
+        \\/// Doc
+        \\pub fn b() void { }
+        \\const c = 2;
+    , &.{"b"}, &.{});
+    // Doc comment only
+    try testReparse(source, 17, 20,
+        \\const a = 1;
+        \\/// Docs
+        \\pub fn b() void {}
+        \\const c = 2;
+    , &.{"b"}, &.{});
+    // Insert a new decl
+    try testReparse(source, 13, 13,
+        \\const a = 1;
+        \\const d = 3;
+        \\/// Doc
+        \\pub fn b() void {}
+        \\const c = 2;
+    , &.{"d"}, &.{});
+    // Remove a decl
+    try testReparse(source, 0, 13,
+        \\/// Doc
+        \\pub fn b() void {}
+        \\const c = 2;
+    , &.{}, &.{});
+    // Edit the last decl
+    try testReparse(source, 50, 51,
+        \\const a = 1;
+        \\/// Doc
+        \\pub fn b() void {}
+        \\const c = 3;
+    , &.{"c"}, &.{});
+}
+
+test "reparse-bodies" {
+    const source =
+        \\fn a() void {}
+        \\fn b() u8 {
+        \\    return 1;
+        \\}
+        \\fn c() void {}
+    ;
+    // Only the body of b changed
+    try testReparse(source, 38, 39,
+        \\fn a() void {}
+        \\fn b() u8 {
+        \\    return 2;
+        \\}
+        \\fn c() void {}
+    , &.{"b"}, &.{ "a", "c" });
+    // The body of c moves down a line
+    try testReparse(source, 41, 41,
+        \\fn a() void {}
+        \\fn b() u8 {
+        \\    return 1;
+        \\
+        \\}
+        \\fn c() void {}
+    , &.{"b"}, &.{"a"});
+    // The header of b changed
+    try testReparse(source, 22, 24,
+        \\fn a() void {}
+        \\fn b() u16 {
+        \\    return 1;
+        \\}
+        \\fn c() void {}
+    , &.{"b"}, &.{});
+    // Callers of a fn with an inferred error set depend on its body
+    try testReparse(
+        \\fn a() void {}
+        \\fn b() !u8 {
+        \\    return 1;
+        \\}
+    , 39, 40,
+        \\fn a() void {}
+        \\fn b() !u8 {
+        \\    return 2;
+        \\}
+    , &.{"b"}, &.{});
+    // Same for a fn returning a type
+    try testReparse(
+        \\fn a() void {}
+        \\fn B() type {
+        \\    return u8;
+        \\}
+    , 40, 42,
+        \\fn a() void {}
+        \\fn B() type {
+        \\    return u16;
+        \\}
+    , &.{"B"}, &.{});
+    // Nothing is kept if there are errors
+    var pool = ArenaPool{ .backing = std.testing.allocator };
+    defer pool.deinit();
+    const old = try pool.parse("reparse.zig", source);
+    defer pool.destroy(old);
+    const broken: [:0]const u8 =
+        \\fn a() void {}
+        \\fn b() u8 {
+        \\    return 2
+        \\}
+        \\fn c() void {}
+    ;
+    const zast = try pool.reparse(old, 38, 40, broken.ptr, broken.len, true);
+    defer pool.destroy(zast);
+    try std.testing.expectEqual(@as(usize, 0), zast.unchanged_bodies.len);
+}
+
+const ParseWorker = struct {
+    pool: *ArenaPool,
+    sources: []const [:0]const u8,
+    next: *std.atomic.Value(usize),
+    failed: bool = false,
+
+    pub fn run(self: *ParseWorker) void {
+        while (true) {
+            const i = self.next.fetchAdd(1, .monotonic);
+            if (i >= self.sources.len) {
+                return;
+            }
+            var name_buf: [32]u8 = undefined;
+            const name = std.fmt.bufPrint(&name_buf, "file{d}.zig", .{i}) catch unreachable;
+            const zast = self.pool.parse(name, self.sources[i]) catch {
+                self.failed = true;
+                return;
+            };
+            self.pool.destroy(zast);
+        }
+    }
+};
+
+fn benchParseThreads(backing: Allocator, label: []const u8, sources: []const [:0]const u8, thread_count: usize) !f64 {
+    var pool = ArenaPool{ .backing = backing };
+    defer pool.deinit();
+    var next = std.atomic.Value(usize).init(0);
+    var workers: [64]ParseWorker = undefined;
+    var threads: [64]std.Thread = undefined;
+    const n = @min(thread_count, workers.len);
+
+    var timer = try std.time.Timer.start();
+    for (0..n) |i| {
+        workers[i] = .{ .pool = &pool, .sources = sources, .next = &next };
+        threads[i] = try std.Thread.spawn(.{}, ParseWorker.run, .{&workers[i]});
+    }
+    for (threads[0..n]) |thread| {
+        thread.join();
+    }
+    const t: f64 = @floatFromInt(timer.read());
+    for (workers[0..n]) |worker| {
+        try std.testing.expect(!worker.failed);
+    }
+    const files: f64 = @floatFromInt(sources.len);
+    const throughput = files / (t / std.time.ns_per_s);
+    std.log.warn("{s} threads={d: >3} {d:8.2}ms {d:8.1} files/s", .{
+        label, n, t / std.time.ns_per_ms, throughput});
+    return throughput;
+}
+
+test "bench-parse-threads" {
+    // Parse throughput should scale with the number of threads
+    try skipUnlessBenchmarking();
+    const allocator = std.testing.allocator;
+    const cpu_count = std.Thread.getCpuCount() catch 1;
+    var sources = std.ArrayList([:0]const u8).init(allocator);
+    defer {
+        for (sources.items) |source| {
+            allocator.free(source);
+        }
+        sources.deinit();
+    }
+    for (0..4 * cpu_count) |_| {
+        try sources.append(try generateSource(allocator, 5000));
+    }
+
+    var thread_count: usize = 1;
+    while (thread_count <= cpu_count) : (thread_count *= 2) {
+        var shared = std.heap.GeneralPurposeAllocator(.{ .thread_safe = true }){};
+        defer _ = shared.deinit();
+        const base = try benchParseThreads(shared.allocator(), "gpa", sources.items, thread_count);
+        const smp = try benchParseThreads(std.heap.smp_allocator, "smp", sources.items, thread_count);
+        std.log.warn("smp/gpa {d:6.2}x", .{smp / base});
+    }
+}
+
+// Structure of arrays view of the ast. The pointers remain valid
+// until the ast is destroyed.
+const AstView = extern struct {
+    node_count: u32 = 0,
+    extra_data_count: u32 = 0,
+    token_count: u32 = 0,
+    node_tags: ?[*]const u8 = null,
+    node_data: ?[*]const NodeData = null,
+    node_main_tokens: ?[*]const TokenIndex = null,
+    extra_data: ?[*]const u32 = null,
+    token_tags: ?[*]const u8 = null,
+    token_starts: ?[*]const u32 = null,
+    child_offsets: ?[*]const u32 = null,
+    child_nodes: ?[*]const NodeIndex = null,
+    node_parents: ?[*]const NodeIndex = null,
+    ident_count: u32 = 0,
+    token_idents: ?[*]const u32 = null,
+    node_ranges: ?[*]const SourceRange = null,
+    node_kinds: ?[*]const u8 = null,
+    node_flags: ?[*]const u8 = null,
+
+    comptime {
+        // The C++ side reads these arrays directly
+        assert(@sizeOf(Tag) == 1);
+        assert(@sizeOf(std.zig.Token.Tag) == 1);
+        assert(@sizeOf(Ast.Node.Data) == @sizeOf(NodeData));
+        assert(@offsetOf(Ast.Node.Data, "lhs") == @offsetOf(NodeData, "lhs"));
+        assert(@offsetOf(Ast.Node.Data, "rhs") == @offsetOf(NodeData, "rhs"));
+    }
+
+    pub fn init(zast: *const ZAst) AstView {
+        const ast = zast.ast;
+        return AstView{
+            .node_count = @intCast(ast.nodes.len),
+            .extra_data_count = @intCast(ast.extra_data.len),
+            .token_count = @intCast(ast.tokens.len),
+            .node_tags = @ptrCast(ast.nodes.items(.tag).ptr),
+            .node_data = @ptrCast(ast.nodes.items(.data).ptr),
+            .node_main_tokens = ast.nodes.items(.main_token).ptr,
+            .extra_data = ast.extra_data.ptr,
+            .token_tags = @ptrCast(ast.tokens.items(.tag).ptr),
+            .token_starts = ast.tokens.items(.start).ptr,
+            .child_offsets = zast.child_offsets.ptr,
+            .child_nodes = zast.child_nodes.ptr,
+            .node_parents = zast.parents.ptr,
+            .ident_count = @intCast(zast.ident_tokens.len),
+            .token_idents = zast.token_idents.ptr,
+            .node_ranges = zast.node_ranges.ptr,
+            .node_kinds = zast.node_kinds.ptr,
+            .node_flags = zast.node_flags.ptr,
+        };
+    }
+};
+
+// Reference implementation of the original linear scan
+fn tokenLocationScan(zast: ZAst, token_index: TokenIndex) Ast.Location {
+    var loc = Ast.Location{
+        .line = 0,
+        .column = 0,
+        .line_start = 0,
+        .line_end = zast.ast.source.len,
+    };
+    const token_start = zast.ast.tokens.items(.start)[token_index];
+    for (zast.line_offsets) |i| {
+        if (i >= token_start) {
+            loc.column = token_start - loc.line_start;
+            loc.line_end = i;
+            break; // Went past
+        }
+        loc.line += 1;
+        loc.line_start = i + 1;
+    }
+    return loc;
+}
+
+fn testTokenLocation(source: [:0]const u8) !void {
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator, source);
+    defer zast.deinit(allocator);
+    for (0..zast.ast.tokens.len) |i| {
+        const a = zast.fastTokenLocation(@intCast(i));
+        const b = tokenLocationScan(zast, @intCast(i));
+        try std.testing.expectEqual(b, a);
+    }
+}
+
+test "token-location" {
+    try testTokenLocation("");
+    try testTokenLocation("\n");
+    try testTokenLocation("const x = 1;");
+    try testTokenLocation("const x = 1;\n");
+    try testTokenLocation("\n\n\nconst x = 1;\n\n");
+    try testTokenLocation(
+        \\const A = struct {
+        \\    // Comment
+        \\    a: u8 = 0,
+        \\
+        \\    pub fn foo(self: A) void {
+        \\        _ = self;
+        \\    }
+        \\};
+    );
+    try testTokenLocation("const a = \"ü\";\r\nconst b = 'ä';");
+}
+
+fn testScanLines(source: []const u8) !void {
+    const allocator = std.testing.allocator;
+    const lines = try ZAst.scanLines(allocator, source);
+    defer {
+        allocator.free(lines.offsets);
+        allocator.free(lines.non_ascii);
+    }
+    // Compare with a byte at a time
+    var line: usize = 0;
+    var non_ascii = false;
+    for (source, 0..) |c, i| {
+        if (c >= 0x80) {
+            non_ascii = true;
+        }
+        if (c == '\n' or i + 1 == source.len) {
+            try std.testing.expectEqual(if (c == '\n') i else source.len, lines.offsets[line]);
+            const bit = (lines.non_ascii[line / 64] >> @intCast(line % 64)) & 1;
+            try std.testing.expectEqual(@intFromBool(non_ascii), bit);
+            line += 1;
+            non_ascii = false;
+        }
+    }
+    try std.testing.expectEqual(line, lines.offsets.len);
+    try std.testing.expectEqual((line + 63) / 64, lines.non_ascii.len);
+}
+
+test "scan-lines" {
+    try testScanLines("");
+    try testScanLines("\n");
+    try testScanLines("const x = 1;");
+    try testScanLines("// é\nconst x = 1;\n\n\n// 😀 at the end");
+    // Lines crossing the vector boundaries at every offset
+    var buf: [300]u8 = undefined;
+    for (&buf, 0..) |*c, i| {
+        c.* = if (i % 7 == 0) '\n' else if (i % 23 == 0) 0xC3 else 'a';
+    }
+    for (0..buf.len) |n| {
+        try testScanLines(buf[0..n]);
+    }
+}
+
+test "utf16-columns" {
+    const allocator = std.testing.allocator;
+    // é is 2 bytes and 1 code unit, 😀 is 4 bytes and 2 code units
+    const source =
+        \\// é 😀
+        \\const s = "é😀"; const y = 1;
+        \\const z = 2;
+    ;
+    var zast = try ZAst.parse(allocator, source);
+    defer zast.deinit(allocator);
+    try std.testing.expect(zast.lineHasNonAscii(0));
+    try std.testing.expect(zast.lineHasNonAscii(1));
+    try std.testing.expect(!zast.lineHasNonAscii(2));
+
+    const decls = zast.ast.rootDecls();
+    const y_token = zast.ast.nodes.items(.main_token)[decls[1]] + 1;
+    try std.testing.expectEqualStrings("y", zast.ast.tokenSlice(y_token));
+    const range = ast_token_range(&zast, y_token);
+    try std.testing.expectEqual(@as(u32, 1), range.start.line);
+    try std.testing.expectEqual(@as(u32, 23), range.start.column);
+    try std.testing.expectEqual(@as(u32, 24), range.end.column);
+    try std.testing.expectEqual(@as(u32, 17), zast.node_ranges[decls[1]].start.column);
+}
+
+// Benchmarks take seconds so they are skipped unless KDEV_ZIG_BENCH is set, eg
+// KDEV_ZIG_BENCH=1 zig test duchain/kdevzigastparser.zig --test-filter bench
+fn skipUnlessBenchmarking() !void {
+    if (!std.process.hasEnvVarConstant("KDEV_ZIG_BENCH")) {
+        return error.SkipZigTest;
+    }
+}
+
+// Generate a file with roughly the given number of lines
+fn generateSource(allocator: Allocator, lines: usize) ![:0]u8 {
+    var source = std.ArrayList(u8).init(allocator);
+    errdefer source.deinit();
+    const writer = source.writer();
+    var i: usize = 0;
+    while (i < lines) : (i += 6) {
+        try writer.print(
+            \\/// Register {d}
+            \\pub const REG{d} = struct {{
+            \\    value: u32 = 0x{x},
+            \\    pub fn read(self: REG{d}) u32 {{ return self.value; }}
+            \\}};
+            \\
+            \\
+        , .{ i, i, i, i });
+    }
+    return source.toOwnedSliceSentinel(0);
+}
+
+test "bench-token-location" {
+    // The time per line should remain roughly constant as the file grows
+    try skipUnlessBenchmarking();
+    const allocator = std.testing.allocator;
+    for ([_]usize{ 1000, 5000, 10000, 20000, 40000 }) |lines| {
+        const source = try generateSource(allocator, lines);
+        defer allocator.free(source);
+
+        var timer = try std.time.Timer.start();
+        var zast = try ZAst.parse(allocator, source);
+        defer zast.deinit(allocator);
+        for (0..zast.ast.tokens.len) |i| {
+            std.mem.doNotOptimizeAway(zast.fastTokenLocation(@intCast(i)));
+        }
+        const t: f64 = @floatFromInt(timer.read());
+        const n: f64 = @floatFromInt(lines);
+        std.log.warn("lines={d: >6} tokens={d: >7} {d:8.2}ms {d:6.2}us/line", .{
+            lines, zast.ast.tokens.len, t / std.time.ns_per_ms, t / std.time.ns_per_us / n});
+    }
+}
+
 const SourceLocation = extern struct {
     line: u32 = 0,
     column: u32 = 0,
@@ -127,6 +1679,17 @@ const NodeKind = enum(u32) {
     FnProto
 };
 
+const NodeFlags = packed struct(u8) {
+    // Var decl whose value is a container, error set or @cImport
+    // that provides the declaration instead
+    skip_decl: bool = false,
+    reserved: u7 = 0,
+};
+
+comptime {
+    assert(std.meta.fields(NodeKind).len <= std.math.maxInt(u8));
+}
+
 // std.mem.len does not check for null
 fn strlen(value: [*c]const u8) usize {
     if (value == null) {
@@ -135,21 +1698,349 @@ fn strlen(value: [*c]const u8) usize {
     return std.mem.len(value);
 }
 
+// How much of a source is parsed, see blankFnBodies
+const ParseMode = enum(u32) {
+    full = 0,
+    // Only declarations, the bodies of functions that do not return
+    // a type are skipped. Used for dependencies that are not open.
+    skeleton = 1,
+};
+
+// Skip to the token closing an already consumed open token
+fn skipBalanced(tokenizer: *std.zig.Tokenizer, open: std.zig.Token.Tag, close: std.zig.Token.Tag) ?std.zig.Token {
+    var depth: u32 = 1;
+    while (true) {
+        const token = tokenizer.next();
+        if (token.tag == .eof) {
+            return null;
+        } else if (token.tag == open) {
+            depth += 1;
+        } else if (token.tag == close) {
+            depth -= 1;
+            if (depth == 0) {
+                return token;
+            }
+        }
+    }
+}
+
+// Replace the contents of fn bodies with whitespace so the parser skips
+// them. Newlines are kept so the location of everything else stays the
+// same. The body of a fn returning a type is the type so it is kept,
+// but the fns inside of it are still blanked.
+fn blankFnBodies(source: [:0]u8) void {
+    var tokenizer = std.zig.Tokenizer.init(source);
+    while (true) {
+        const token = tokenizer.next();
+        switch (token.tag) {
+            .eof => return,
+            .keyword_fn => {},
+            else => continue,
+        }
+        var next = tokenizer.next();
+        if (next.tag == .identifier) {
+            next = tokenizer.next();
+        }
+        switch (next.tag) {
+            .eof => return,
+            .l_paren => {},
+            else => continue,
+        }
+        var last = skipBalanced(&tokenizer, .l_paren, .r_paren) orelse return;
+
+        // Scan the return type up to the body. A fn type or proto ends
+        // without one.
+        var body: ?std.zig.Token = null;
+        var in_container_type = false;
+        scan: while (true) {
+            const t = tokenizer.next();
+            switch (t.tag) {
+                .eof => return,
+                .l_paren => _ = skipBalanced(&tokenizer, .l_paren, .r_paren) orelse return,
+                .l_bracket => _ = skipBalanced(&tokenizer, .l_bracket, .r_bracket) orelse return,
+                .keyword_struct, .keyword_enum, .keyword_union, .keyword_opaque, .keyword_error => {
+                    in_container_type = true;
+                },
+                .l_brace => {
+                    if (!in_container_type) {
+                        body = t;
+                        break :scan;
+                    }
+                    _ = skipBalanced(&tokenizer, .l_brace, .r_brace) orelse return;
+                    in_container_type = false;
+                },
+                .semicolon, .comma, .equal, .r_paren, .r_bracket, .r_brace => break :scan,
+                else => {},
+            }
+            last = t;
+        }
+        const lbrace = body orelse continue;
+        const returns_type = last.tag == .identifier
+            and std.mem.eql(u8, source[last.loc.start..last.loc.end], "type");
+        if (returns_type) {
+            continue;
+        }
+        const rbrace = skipBalanced(&tokenizer, .l_brace, .r_brace) orelse return;
+        for (source[lbrace.loc.end..rbrace.loc.start]) |*c| {
+            if (c.* != '\n') {
+                c.* = ' ';
+            }
+        }
+    }
+}
+
+test "skeleton-parse" {
+    const allocator = std.testing.allocator;
+    const source =
+        \\/// Adds
+        \\pub fn add(a: u8, b: u8) u8 {
+        \\    const c = a + b;
+        \\    return c;
+        \\}
+        \\pub fn List(comptime T: type) type {
+        \\    return struct {
+        \\        items: []T,
+        \\        pub fn first(self: @This()) T { return self.items[0]; }
+        \\    };
+        \\}
+        \\fn fail() error{Oops}!struct { x: u8 } { return error.Oops; }
+        \\extern fn ext(cb: *const fn (u8) void) callconv(.c) void;
+        \\const cb: *const fn () void = undefined;
+    ;
+    var full = try ZAst.parse(allocator, source);
+    defer full.deinit(allocator);
+    var skeleton = try ZAst.parseWithMode(allocator, source, .skeleton);
+    defer skeleton.deinit(allocator);
+    try std.testing.expectEqual(@as(usize, 0), skeleton.ast.errors.len);
+    try std.testing.expectEqual(ParseMode.skeleton, skeleton.mode);
+    try std.testing.expectEqualStrings(source, skeleton.ast.source);
+    try std.testing.expect(skeleton.ast.nodes.len < full.ast.nodes.len);
+
+    // Only the return of the struct in List is left
+    var returns: usize = 0;
+    for (skeleton.ast.nodes.items(.tag)) |tag| {
+        if (tag == .@"return") {
+            returns += 1;
+        }
+    }
+    try std.testing.expectEqual(@as(usize, 1), returns);
+
+    // Declarations are where they were
+    const full_decls = full.ast.rootDecls();
+    const skeleton_decls = skeleton.ast.rootDecls();
+    try std.testing.expectEqual(full_decls.len, skeleton_decls.len);
+    for (full_decls, skeleton_decls) |a, b| {
+        try std.testing.expectEqual(full.node_ranges[a], skeleton.node_ranges[b]);
+        try std.testing.expectEqual(full.ast.nodes.items(.tag)[a], skeleton.ast.nodes.items(.tag)[b]);
+    }
+    try std.testing.expectEqualStrings("/// Adds", skeleton.nodeComment(skeleton_decls[0]).?);
+}
+
+// Sources are passed as a pointer and length. If the caller says the byte
+// after the end is a NUL terminator (eg a QByteArray) the source is borrowed,
+// otherwise a terminated copy is made with the allocator. Nothing past the
+// end is read unless it is terminated.
+fn terminatedSource(allocator: Allocator, ptr: [*]const u8, len: usize, is_terminated: bool) ![:0]const u8 {
+    if (is_terminated) {
+        return ptr[0..len :0];
+    }
+    return try allocator.dupeZ(u8, ptr[0..len]);
+}
+
+test "terminated-source" {
+    const allocator = std.testing.allocator;
+    const borrowed: [:0]const u8 = "const x = 1;";
+    const a = try terminatedSource(allocator, borrowed.ptr, borrowed.len, true);
+    try std.testing.expectEqual(borrowed.ptr, a.ptr);
+
+    // Only the bytes passed are read
+    const unterminated = "const x = 1;const y = 2;";
+    const b = try terminatedSource(allocator, unterminated.ptr, 12, false);
+    defer allocator.free(b);
+    try std.testing.expect(b.ptr != unterminated.ptr);
+    try std.testing.expectEqualStrings("const x = 1;", b);
+}
+
 const ZError = extern struct {
-    const Self = @This();
     severity: Severity,
     range: SourceRange,
     message: [*c]const u8,
+};
+
+// All errors of an ast in a single allocation laid out as
+// [header][errors][messages] so it can be freed with one call.
+const ZErrorList = extern struct {
+    const Self = @This();
+    count: u32 = 0,
+    size: u32 = 0,
+    errors: ?[*]ZError = null,
+
+    pub fn init(allocator: std.mem.Allocator, zast: *const ZAst) !*Self {
+        const errors = zast.ast.errors;
+        var counter = std.io.countingWriter(std.io.null_writer);
+        for (errors) |err| {
+            try zast.ast.renderError(err, counter.writer());
+            try counter.writer().writeByte(0);
+        }
+        const errors_offset = std.mem.alignForward(usize, @sizeOf(Self), @alignOf(ZError));
+        const messages_offset = errors_offset + errors.len * @sizeOf(ZError);
+        const size = messages_offset + counter.bytes_written;
+        const buf = try allocator.alignedAlloc(u8, @alignOf(Self), size);
+        const self: *Self = @ptrCast(buf.ptr);
+        const items: [*]ZError = @ptrCast(@alignCast(buf.ptr + errors_offset));
+        var fbs = std.io.fixedBufferStream(buf[messages_offset..]);
+        for (errors, 0..) |err, i| {
+            const start = fbs.pos;
+            try zast.ast.renderError(err, fbs.writer());
+            try fbs.writer().writeByte(0);
+            items[i] = ZError{
+                .severity = if (err.is_note) .Hint else .Error,
+                .range = errorRange(zast, err),
+                .message = @ptrCast(buf[messages_offset + start ..].ptr),
+            };
+        }
+        self.* = Self{
+            .count = @intCast(errors.len),
+            .size = @intCast(size),
+            .errors = if (errors.len > 0) items else null,
+        };
+        return self;
+    }
 
     pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
-        const msg_len = strlen(self.message);
-        if (msg_len > 0) {
-            allocator.free(self.message[0 .. msg_len + 1]);
+        const buf: [*]align(@alignOf(Self)) u8 = @ptrCast(self);
+        allocator.free(buf[0..self.size]);
+    }
+};
+
+// Range of the token the error points at. If the error refers to the
+// end of the previous token the range is empty and placed right after it.
+fn errorRange(zast: *const ZAst, err: Ast.Error) SourceRange {
+    const range = zast.tokenRange(err.token);
+    return SourceRange{
+        .start = if (err.token_is_prev) range.end else range.start,
+        .end = range.end,
+    };
+}
+
+test "error-list" {
+    const allocator = std.testing.allocator;
+    const source = "const x = 1\nconst y = ;\n";
+    var zast = try ZAst.parse(allocator, source);
+    defer zast.deinit(allocator);
+    try std.testing.expect(zast.ast.errors.len > 0);
+
+    const list = try ZErrorList.init(allocator, &zast);
+    defer list.deinit(allocator);
+    try std.testing.expectEqual(zast.ast.errors.len, list.count);
+    const errors = list.errors.?[0..list.count];
+    for (errors, zast.ast.errors) |e, err| {
+        var buf: [4096]u8 = undefined;
+        var fbs = std.io.fixedBufferStream(&buf);
+        try zast.ast.renderError(err, fbs.writer());
+        try std.testing.expectEqualStrings(fbs.getWritten(), std.mem.span(e.message));
+        try std.testing.expect(e.range.end.column >= e.range.start.column);
+    }
+
+    var ok = try ZAst.parse(allocator, "const x = 1;");
+    defer ok.deinit(allocator);
+    const empty = try ZErrorList.init(allocator, &ok);
+    defer empty.deinit(allocator);
+    try std.testing.expectEqual(0, empty.count);
+    try std.testing.expect(empty.errors == null);
+}
+
+// Names passed to @import in a source, found by only tokenizing it so
+// a file can be ordered before the files that import it without parsing.
+// The names point into the source, free with destroy_imports.
+const ZImportList = extern struct {
+    const Self = @This();
+    count: u32 = 0,
+    imports: ?[*]SourceSlice = null,
+
+    pub fn init(allocator: std.mem.Allocator, source: [:0]const u8, base: [*]const u8) !*Self {
+        var imports: std.ArrayListUnmanaged(SourceSlice) = .{};
+        defer imports.deinit(allocator);
+        var tokenizer = std.zig.Tokenizer.init(source);
+        while (true) {
+            const token = tokenizer.next();
+            switch (token.tag) {
+                .eof => break,
+                .builtin => {},
+                else => continue,
+            }
+            if (!std.mem.eql(u8, source[token.loc.start..token.loc.end], "@import")) {
+                continue;
+            }
+            if (tokenizer.next().tag != .l_paren) {
+                continue;
+            }
+            const str = tokenizer.next();
+            if (str.tag != .string_literal or tokenizer.next().tag != .r_paren) {
+                continue;
+            }
+            // Without the quotes, names with escapes are left as is
+            const start = str.loc.start + 1;
+            const end = str.loc.end - 1;
+            if (end <= start) {
+                continue;
+            }
+            try imports.append(allocator, SourceSlice{
+                .data = base + start,
+                .len = @intCast(end - start),
+            });
         }
-        allocator.destroy(self);
+
+        const items_offset = std.mem.alignForward(usize, @sizeOf(Self), @alignOf(SourceSlice));
+        const size = items_offset + imports.items.len * @sizeOf(SourceSlice);
+        const buf = try allocator.alignedAlloc(u8, @alignOf(Self), size);
+        const self: *Self = @ptrCast(buf.ptr);
+        const items: [*]SourceSlice = @ptrCast(@alignCast(buf.ptr + items_offset));
+        @memcpy(items[0..imports.items.len], imports.items);
+        self.* = Self{
+            .count = @intCast(imports.items.len),
+            .imports = if (imports.items.len > 0) items else null,
+        };
+        return self;
+    }
+
+    fn allocSize(self: *const Self) usize {
+        const items_offset = std.mem.alignForward(usize, @sizeOf(Self), @alignOf(SourceSlice));
+        return items_offset + self.count * @sizeOf(SourceSlice);
+    }
+
+    pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+        const buf: [*]align(@alignOf(Self)) u8 = @ptrCast(self);
+        allocator.free(buf[0..self.allocSize()]);
     }
 };
 
+test "import-list" {
+    const allocator = std.testing.allocator;
+    const source =
+        \\const std = @import("std");
+        \\const a = @import("a.zig").Foo;
+        \\// @import("commented.zig")
+        \\const s = "@import(\"string.zig\")";
+        \\const b = @import ( "b/b.zig" );
+        \\const c = @import(name);
+        \\fn f() void { _ = @import("inner.zig"); }
+        \\
+    ;
+    const list = try ZImportList.init(allocator, source, source.ptr);
+    defer list.deinit(allocator);
+    const expected = [_][]const u8{ "std", "a.zig", "b/b.zig", "inner.zig" };
+    try std.testing.expectEqual(expected.len, list.count);
+    for (list.imports.?[0..list.count], expected) |item, name| {
+        try std.testing.expectEqualStrings(name, item.data.?[0..item.len]);
+    }
+
+    const empty = try ZImportList.init(allocator, "const x = 1;", "const x = 1;");
+    defer empty.deinit(allocator);
+    try std.testing.expectEqual(0, empty.count);
+    try std.testing.expect(empty.imports == null);
+}
+
 fn printAstError(zast: *ZAst, filename: []const u8, source: []const u8) !void {
     const stderr = std.io.getStdErr().writer();
     for (zast.ast.errors) |parse_error| {
@@ -225,29 +2116,27 @@ const ZCompletion = extern struct {
     }
 };
 
-export fn complete_expr(text_ptr: [*c]const u8, text_following_ptr: [*c]const u8) ?*ZCompletion {
-    const text_len = strlen(text_ptr);
-    const following_len = strlen(text_following_ptr);
-    if (text_len == 0) {
+export fn complete_expr(text_ptr: [*c]const u8, text_len: u32, text_following_ptr: [*c]const u8, following_len: u32) ?*ZCompletion {
+    if (text_ptr == null or text_len == 0) {
         return null;
     }
-    const text: [:0]const u8 = text_ptr[0..text_len :0];
-    const following: [:0]const u8 = text_following_ptr[0..following_len:0];
-    std.log.info("zig: complete: {s} {s}", .{text, following});
+    const text = text_ptr[0..text_len];
+    const following = if (text_following_ptr == null) "" else text_following_ptr[0..following_len];
+    std.log.debug("zig: complete: {s} {s}", .{text, following});
 
     const line_start = std.mem.lastIndexOfScalar(u8, text, '\n') orelse 0;
-    const last_line = text[line_start..];
-
 
-    const allocator = gpa.allocator();
+    const allocator = globalAllocator();
+    // Only the last line is parsed so copy it to add the terminator
+    const last_line = allocator.dupeZ(u8, text[line_start..]) catch {
+        return null;
+    };
+    defer allocator.free(last_line);
     var completion = ZCompletion{};
     var zast = ZAst.parse(allocator, last_line) catch {
         return null;
     };
     defer zast.deinit(allocator);
-    const stdout = std.io.getStdOut().writer();
-    dumpAstFlat(zast.ast, stdout) catch {};
-    //const decls = ast.rootDecls();
 
     if (std.mem.endsWith(u8, last_line, ".")) {
         completion.result_type = .Field;
@@ -322,9 +2211,9 @@ export fn complete_expr(text_ptr: [*c]const u8, text_following_ptr: [*c]const u8
     return result;
 }
 
-export fn ast_tag_by_name(tag_name: [*c]const u8) u32 {
-    if (tag_name) |n| {
-        const name = std.mem.span(n);
+export fn ast_tag_by_name(tag_name: [*c]const u8, len: u32) u32 {
+    if (tag_name != null) {
+        const name = tag_name[0..len];
         inline for(std.meta.fields(std.zig.Ast.Node.Tag)) |f| {
             if (std.mem.eql(u8, name, f.name)) {
                 return f.value;
@@ -334,30 +2223,36 @@ export fn ast_tag_by_name(tag_name: [*c]const u8) u32 {
     return std.math.maxInt(u32);
 }
 
-export fn parse_ast(name_ptr: [*c]const u8, source_ptr: [*c]const u8, print_ast: bool) ?*ZAst {
-    const name_len = strlen(name_ptr);
-    const source_len = strlen(source_ptr);
+// NOTE: The source is borrowed from the caller when it was NUL terminated
+export fn ast_source(ptr: ?*ZAst) SourceSlice {
+    if (ptr) |zast| {
+        return SourceSlice{ .data = zast.ast.source.ptr, .len = @intCast(zast.ast.source.len) };
+    }
+    return SourceSlice{};
+}
+
+export fn ast_parse_mode(ptr: ?*ZAst) ParseMode {
+    if (ptr) |zast| {
+        return zast.mode;
+    }
+    return .full;
+}
 
-    if (name_len == 0 or source_len == 0) {
+export fn parse_ast(name_ptr: [*c]const u8, name_len: u32, source_ptr: [*c]const u8, source_len: u32, is_terminated: bool, print_ast: bool, mode: ParseMode) ?*ZAst {
+    if (name_ptr == null or source_ptr == null or name_len == 0 or source_len == 0) {
         std.log.warn("zig: name or source is empty", .{});
         return null;
     }
 
     const name = name_ptr[0..name_len];
-    const source: [:0]const u8 = source_ptr[0..source_len :0];
 
     std.log.info("zig: parsing filename '{s}'...", .{name});
 
-    const allocator = gpa.allocator();
-    const zast: *ZAst = allocator.create(ZAst) catch |err| {
+    const zast = arena_pool.parseKeyed(ArenaPool.keyFor(name), source_ptr, source_len, is_terminated, mode) catch |err| {
         std.log.warn("zig: parsing {s} error: {}", .{ name, err });
         return null;
     };
-    zast.*= ZAst.parse(allocator, source) catch |err| {
-        std.log.warn("zig: parsing {s} error: {}", .{ name, err });
-        allocator.destroy(zast);
-        return null;
-    };
+    const source = zast.ast.source;
 
     if (zast.ast.errors.len > 0) {
         printAstError(zast, name, source) catch |err| {
@@ -374,52 +2269,105 @@ export fn parse_ast(name_ptr: [*c]const u8, source_ptr: [*c]const u8, print_ast:
     return zast;
 }
 
-export fn ast_error_count(ptr: ?*ZAst) u32 {
-    // std.log.warn("zig: ast_error_count", .{});
+// The source is the complete new document where the range edit_start..edit_end
+// of the old ast's source was replaced. The old ast must remain valid until this
+// returns.
+export fn reparse_ast(old_ptr: ?*ZAst, edit_start: u32, edit_end: u32, source_ptr: [*c]const u8, source_len: u32, is_terminated: bool) ?*ZAst {
+    const old = old_ptr orelse return null;
+    if (source_ptr == null or source_len == 0) {
+        return null;
+    }
+    return arena_pool.reparse(old, edit_start, edit_end, source_ptr, source_len, is_terminated) catch |err| {
+        std.log.warn("zig: reparse error: {}", .{err});
+        return null;
+    };
+}
+
+// Bodies of root fn and test decls the last reparse did not touch
+// while nothing outside of the bodies changed, see diffRootDecls
+export fn ast_unchanged_bodies(ptr: ?*ZAst) NodeSpan {
     if (ptr) |zast| {
-        return @intCast(zast.ast.errors.len);
+        return NodeSpan{ .data = zast.unchanged_bodies.ptr, .len = @intCast(zast.unchanged_bodies.len) };
     }
-    return 0;
+    return NodeSpan{};
+}
+
+// Key of the cache file for a source, see AstCache
+export fn ast_cache_key(source_ptr: [*c]const u8, source_len: u32, mode: ParseMode) u64 {
+    if (source_ptr == null) {
+        return 0;
+    }
+    return AstCache.keyFor(source_ptr[0..source_len], mode);
 }
 
-export fn ast_error_at(ptr: ?*ZAst, index: u32) ?*ZError {
-    // std.log.warn("zig: ast_error_at {}", .{index});
+// Contents of the cache file of the ast, null if it has errors. The result
+// must be freed with destroy_cache_data.
+export fn ast_cache_data(ptr: ?*ZAst, key: u64, out_len: ?*u32) ?[*]const u8 {
     if (ptr) |zast| {
-        if (index >= zast.ast.errors.len) {
+        if (zast.ast.errors.len > 0) {
             return null;
         }
-        const allocator = gpa.allocator();
-        const result = allocator.create(ZError) catch {
-            std.log.warn("zig: ast_error_at alloc failed", .{});
+        const data = AstCache.encode(globalAllocator(), zast, key) catch |err| {
+            std.log.warn("zig: failed to encode ast cache: {}", .{err});
             return null;
         };
-        // TODO: Expanding buffer?
-        var buf: [4096]u8 = undefined;
-        var fbs = std.io.fixedBufferStream(&buf);
+        if (out_len) |len| {
+            len.* = @intCast(data.len);
+        }
+        return data.ptr;
+    }
+    return null;
+}
 
-        const err = zast.ast.errors[index];
-        const loc = zast.fastTokenLocation(err.token);
-        zast.ast.renderError(err, fbs.writer()) catch {
-            std.log.warn("zig: ast_error_at alloc error message too large", .{});
-            allocator.destroy(result);
-            return null;
+export fn destroy_cache_data(ptr: ?[*]const u8, len: u32) void {
+    if (ptr) |data| {
+        globalAllocator().free(data[0..len]);
+    }
+}
+
+export fn ast_cache_write(ptr: ?*ZAst, path_ptr: [*c]const u8, path_len: u32) bool {
+    if (ptr) |zast| {
+        if (path_ptr == null or path_len == 0) {
+            return false;
+        }
+        const path = path_ptr[0..path_len];
+        AstCache.write(zast, std.fs.cwd(), path) catch |err| {
+            std.log.warn("zig: failed to write ast cache {s}: {}", .{ path, err });
+            return false;
         };
-        const msg = allocator.dupeZ(u8, fbs.getWritten()) catch {
-            std.log.warn("zig: ast_error_at message alloc failed", .{});
-            allocator.destroy(result);
+        return true;
+    }
+    return false;
+}
+
+// Returns null if there is no valid cache file for the source
+export fn ast_cache_load(name_ptr: [*c]const u8, name_len: u32, path_ptr: [*c]const u8, path_len: u32, source_ptr: [*c]const u8, source_len: u32, is_terminated: bool, key: u64, mode: ParseMode) ?*ZAst {
+    if (name_ptr == null or path_ptr == null or source_ptr == null or path_len == 0 or source_len == 0) {
+        return null;
+    }
+    const path = path_ptr[0..path_len];
+    return arena_pool.load(name_ptr[0..name_len], path, source_ptr, source_len, is_terminated, mode, key) catch |err| {
+        if (err != error.FileNotFound) {
+            std.log.debug("zig: ast cache {s} not used: {}", .{ path, err });
+        }
+        return null;
+    };
+}
+
+export fn ast_error_count(ptr: ?*ZAst) u32 {
+    // std.log.warn("zig: ast_error_count", .{});
+    if (ptr) |zast| {
+        return @intCast(zast.ast.errors.len);
+    }
+    return 0;
+}
+
+export fn ast_errors(ptr: ?*ZAst) ?*ZErrorList {
+    if (ptr) |zast| {
+        return ZErrorList.init(globalAllocator(), zast) catch |err| {
+            std.log.warn("zig: ast_errors failed {}", .{err});
             return null;
         };
-        result.* = ZError{ .severity = if (err.is_note) .Hint else .Error, .range = SourceRange{
-            .start = SourceLocation{
-                .line = @intCast(loc.line),
-                .column = @intCast(loc.column),
-            },
-            .end = SourceLocation{
-                .line = @intCast(loc.line),
-                .column = @intCast(loc.column),
-            },
-        }, .message = msg };
-        return result;
     }
     return null;
 }
@@ -427,21 +2375,43 @@ export fn ast_error_at(ptr: ?*ZAst, index: u32) ?*ZError {
 export fn destroy_ast(ptr: ?*ZAst) void {
     // std.log.debug("zig: destroy_ast {}", .{@intFromPtr(ptr)});
     if (ptr) |zast| {
-        zast.deinit(gpa.allocator());
+        arena_pool.destroy(zast);
+    }
+}
+
+export fn scan_imports(source_ptr: [*c]const u8, source_len: u32, is_terminated: bool) ?*ZImportList {
+    if (source_ptr == null) {
+        return null;
     }
+    const allocator = globalAllocator();
+    const source = terminatedSource(allocator, source_ptr, source_len, is_terminated) catch |err| {
+        std.log.warn("zig: scan_imports failed {}", .{err});
+        return null;
+    };
+    defer if (source.ptr != source_ptr) allocator.free(source);
+    // Names always point into the caller's source, not the copy
+    return ZImportList.init(allocator, source, source_ptr) catch |err| {
+        std.log.warn("zig: scan_imports failed {}", .{err});
+        return null;
+    };
 }
 
-export fn destroy_error(ptr: ?*ZError) void {
-    // std.log.debug("zig: destroy_error {}", .{@intFromPtr(ptr)});
-    if (ptr) |zerr| {
-        zerr.deinit(gpa.allocator());
+export fn destroy_imports(ptr: ?*ZImportList) void {
+    if (ptr) |list| {
+        list.deinit(globalAllocator());
+    }
+}
+
+export fn destroy_errors(ptr: ?*ZErrorList) void {
+    if (ptr) |list| {
+        list.deinit(globalAllocator());
     }
 }
 
 export fn destroy_completion(ptr: ?*ZCompletion) void {
     // std.log.debug("zig: destroy_completion {}", .{@intFromPtr(ptr)});
     if (ptr) |zcompletion| {
-        zcompletion.deinit(gpa.allocator());
+        zcompletion.deinit(globalAllocator());
     }
 }
 
@@ -557,22 +2527,54 @@ export fn ast_node_range(ptr: ?*ZAst, index: NodeIndex) SourceRange {
         std.log.warn("zig: ast_node_range index out of range {}", .{index});
         return SourceRange{};
     }
-    // TODO: What is the correct start_offset?
-    const first_token = zast.ast.firstToken(index);
-    const start_loc = zast.fastTokenLocation(first_token);
-    const last_token = zast.ast.lastToken(index);
-    const end_loc = zast.fastTokenLocation(last_token);
-
-    return SourceRange{
-        .start = SourceLocation{
-            .line = @intCast(start_loc.line),
-            .column = @intCast(start_loc.column),
-        },
-        .end = SourceLocation{
-            .line = @intCast(end_loc.line),
-            .column = @intCast(end_loc.column),
-        },
-    };
+    return zast.node_ranges[index];
+}
+
+test "node-range" {
+    const allocator = std.testing.allocator;
+    const source = try generateSource(allocator, 200);
+    defer allocator.free(source);
+    var zast = try ZAst.parse(allocator, source);
+    defer zast.deinit(allocator);
+    for (0..zast.ast.nodes.len) |i| {
+        const node: NodeIndex = @intCast(i);
+        const start = tokenLocationScan(zast, zast.ast.firstToken(node));
+        const end = tokenLocationScan(zast, zast.ast.lastToken(node));
+        const range = ast_node_range(&zast, node);
+        try std.testing.expectEqual(start.line, range.start.line);
+        try std.testing.expectEqual(start.column, range.start.column);
+        try std.testing.expectEqual(end.line, range.end.line);
+        try std.testing.expectEqual(end.column, range.end.column);
+    }
+}
+
+test "parents-errors" {
+    // Unreserved nodes are left behind by the parser, they must not
+    // be given a parent
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator,
+        \\const x = foo(;
+        \\fn bar( void {
+        \\    const y = switch (x) { 1 => , else };
+        \\}
+        \\const z = .{ .a = };
+    );
+    defer zast.deinit(allocator);
+    try std.testing.expect(zast.ast.errors.len > 0);
+    const node_count = zast.ast.nodes.len;
+    for (0..node_count) |i| {
+        var steps: usize = 0;
+        var node: NodeIndex = @intCast(i);
+        while (node != 0) : (node = zast.parents[node]) {
+            try std.testing.expect(node < node_count);
+            steps += 1;
+            try std.testing.expect(steps <= node_count);
+        }
+        const parent = zast.parents[i];
+        if (i != 0 and parent != 0) {
+            try std.testing.expect(std.mem.indexOfScalar(NodeIndex, zast.children(parent), @intCast(i)) != null);
+        }
+    }
 }
 
 // Assumes token is in the valid range
@@ -581,17 +2583,10 @@ fn isTokenSliceEql(ast: Ast, token: TokenIndex, value: []const u8) bool {
 }
 
 // Node kind is only needed for contexts
-export fn ast_node_kind(ptr: ?*ZAst, index: NodeIndex) u32 {
-    if (ptr == null) {
-        return @intFromEnum(NodeKind.Unknown);
-    }
-    const zast = ptr.?;
-    if (index >= zast.ast.nodes.len) {
-        return @intFromEnum(NodeKind.Unknown);
-    }
-    const main_token = zast.ast.nodes.items(.main_token)[index];
-    const tag: Tag = zast.ast.nodes.items(.tag)[index];
-    const kind: NodeKind = switch (tag) {
+fn nodeKind(ast: Ast, index: NodeIndex) NodeKind {
+    const main_token = ast.nodes.items(.main_token)[index];
+    const tag: Tag = ast.nodes.items(.tag)[index];
+    return switch (tag) {
         .fn_decl => .FunctionDecl,
         .fn_proto,
         .fn_proto_multi,
@@ -607,7 +2602,7 @@ export fn ast_node_kind(ptr: ?*ZAst, index: NodeIndex) u32 {
         .container_decl_two,
         .container_decl_two_trailing,
         .container_decl_arg,
-        .container_decl_arg_trailing => switch (zast.ast.tokens.items(.tag)[main_token]) {
+        .container_decl_arg_trailing => switch (ast.tokens.items(.tag)[main_token]) {
             .keyword_enum => .EnumDecl,
             .keyword_union => .UnionDecl,
             else => .ContainerDecl
@@ -658,7 +2653,24 @@ export fn ast_node_kind(ptr: ?*ZAst, index: NodeIndex) u32 {
         .root => .Module,
         else => .Unknown,
     };
-    return @intFromEnum(kind);
+}
+
+export fn ast_node_kind(ptr: ?*ZAst, index: NodeIndex) u32 {
+    if (ptr) |zast| {
+        if (index < zast.node_kinds.len) {
+            return zast.node_kinds[index];
+        }
+    }
+    return @intFromEnum(NodeKind.Unknown);
+}
+
+export fn ast_node_flags(ptr: ?*ZAst, index: NodeIndex) u8 {
+    if (ptr) |zast| {
+        if (index < zast.node_flags.len) {
+            return zast.node_flags[index];
+        }
+    }
+    return 0;
 }
 
 fn testNodeKind(source: [:0]const u8, index: NodeIndex, expected: NodeKind) !void {
@@ -674,7 +2686,7 @@ fn testNodeKind(source: [:0]const u8, index: NodeIndex, expected: NodeKind) !voi
     }
     try std.testing.expect(ast.ast.errors.len == 0);
     const r = ast_node_kind(&ast, index);
-    try std.testing.expect(r == expected);
+    try std.testing.expectEqual(@intFromEnum(expected), r);
 }
 
 test "node-kind" {
@@ -683,6 +2695,27 @@ test "node-kind" {
        , 0, .Module);
 }
 
+test "node-flags" {
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator,
+        \\const A = struct {};
+        \\const B = enum { a };
+        \\const C = error{ Oops };
+        \\const c = @cImport({});
+        \\const std = @import("std");
+        \\const x: u8 = 1;
+    );
+    defer zast.deinit(allocator);
+    const decls = zast.ast.rootDecls();
+    const expected = [_]bool{ true, true, true, true, false, false };
+    try std.testing.expectEqual(expected.len, decls.len);
+    for (decls, expected) |decl, skip| {
+        try std.testing.expectEqual(@intFromEnum(NodeKind.VarDecl), ast_node_kind(&zast, decl));
+        const flags: NodeFlags = @bitCast(ast_node_flags(&zast, decl));
+        try std.testing.expectEqual(skip, flags.skip_decl);
+    }
+}
+
 
 export fn ast_node_tag(ptr: ?*ZAst, index: NodeIndex) u32 {
     if (ptr) |zast| {
@@ -705,34 +2738,6 @@ export fn ast_token_slice(ptr: ?*ZAst, token: TokenIndex) SourceSlice {
     return SourceSlice{};
 }
 
-fn findNodeComment(zast: *const ZAst, node: NodeIndex) ?[]const u8 {
-    const first_token = zast.ast.firstToken(node);
-    const loc = zast.fastTokenLocation(first_token);
-    // std.log.warn("node start: {}", .{loc});
-    const comment_end = loc.line_start -| 1;
-    var comment_start: usize = comment_end;
-
-    while (comment_start > 3) {
-        // Find previous next line
-        const remaining = zast.ast.source[0..comment_start];
-        // std.log.warn("remaining: '{s}'", .{remaining});
-        const previous_line_start = std.mem.lastIndexOfScalar(u8, remaining, '\n') orelse 0;
-        // std.log.warn("previous_line_start: '{}'", .{previous_line_start});
-
-        const comment = std.mem.trimLeft(u8, zast.ast.source[previous_line_start..comment_end], " \t\n");
-        if (std.mem.startsWith(u8, comment, "//")) {
-            comment_start = previous_line_start;
-        } else {
-            break;
-        }
-    }
-    const comment = std.mem.trim(u8, zast.ast.source[comment_start..comment_end], " \t\r\n");
-    if (comment.len < 3 or comment.len > 5000) {
-        return null;
-    }
-    return comment;
-}
-
 fn testNodeComment(source: [:0]const u8, tag: Tag, expected: ?[]const u8) !void {
     const allocator = std.testing.allocator;
     var ast = try ZAst.parse(allocator, source);
@@ -751,7 +2756,7 @@ fn testNodeComment(source: [:0]const u8, tag: Tag, expected: ?[]const u8) !void
         try dumpAstFlat(ast.ast, stdout);
         try std.testing.expect(n != null);
     }
-    const r = findNodeComment(&ast, n.?);
+    const r = ast.nodeComment(n.?);
     if (expected) |value| {
         try std.testing.expect(r != null);
         try std.testing.expectEqualSlices(u8, value, r.?);
@@ -818,12 +2823,21 @@ test "node-comment" {
         \\   field: u8 = 0,
         \\};
         , .container_field_init, "/// This field is a u8");
+    try testNodeComment(
+        \\// Detached comment
+        \\
+        \\pub fn foo() void {}
+        , .fn_decl, null);
+    try testNodeComment(
+        \\const x = 1; // Trailing comment
+        \\pub fn foo() void {}
+        , .fn_decl, null);
 }
 
 export fn ast_node_comment(ptr: ?*ZAst, node: NodeIndex) SourceSlice {
     if (ptr) |zast| {
         if (node < zast.ast.nodes.len) {
-            if (findNodeComment(zast, node)) |comment| {
+            if (zast.nodeComment(node)) |comment| {
                 return SourceSlice{.data=comment.ptr, .len=@intCast(comment.len)};
             }
         }
@@ -834,18 +2848,7 @@ export fn ast_node_comment(ptr: ?*ZAst, node: NodeIndex) SourceSlice {
 export fn ast_token_range(ptr: ?*ZAst, token: TokenIndex) SourceRange {
     if (ptr) |zast| {
         if (token < zast.ast.tokens.len) {
-            const loc = zast.fastTokenLocation(token);
-            const name = zast.ast.tokenSlice(token);
-            return SourceRange{
-                .start = SourceLocation{
-                    .line = @intCast(loc.line),
-                    .column = @intCast(loc.column),
-                },
-                .end = SourceLocation{
-                    .line = @intCast(loc.line),
-                    .column = @intCast(loc.column + name.len),
-                },
-            };
+            return zast.tokenRange(token);
         }
     }
     return SourceRange{};
@@ -935,6 +2938,16 @@ export fn ast_fn_return_type(ptr: ?*ZAst, index: NodeIndex) NodeIndex {
     return 0;
 }
 
+// Copy up to cap items to out and return the total number of items so the
+// caller can retry with a larger buffer if needed
+fn fillBuffer(comptime T: type, out: ?[*]T, cap: u32, items: []const T) u32 {
+    if (out) |dst| {
+        const n = @min(cap, items.len);
+        @memcpy(dst[0..n], items[0..n]);
+    }
+    return @intCast(items.len);
+}
+
 export fn ast_call_arg_count(ptr: ?*ZAst, index: NodeIndex) u32 {
     if (ptr) |zast| {
         if (index < zast.ast.nodes.len) {
@@ -962,6 +2975,18 @@ export fn ast_call_arg_at(ptr: ?*ZAst, index: NodeIndex, i: u32) NodeIndex {
 }
 
 
+export fn ast_call_args(ptr: ?*ZAst, index: NodeIndex, out: ?[*]NodeIndex, cap: u32) u32 {
+    if (ptr) |zast| {
+        if (index < zast.ast.nodes.len) {
+            var buffer: [1]Ast.Node.Index = undefined;
+            if (zast.ast.fullCall(&buffer, index)) |call| {
+                return fillBuffer(NodeIndex, out, cap, call.ast.params);
+            }
+        }
+    }
+    return 0;
+}
+
 export fn ast_fn_param_count(ptr: ?*ZAst, index: NodeIndex) u32 {
     if (ptr) |zast| {
         if (index < zast.ast.nodes.len) {
@@ -993,6 +3018,19 @@ const ParamData = extern struct {
     info: ParamDataInfo = .{},
 };
 
+fn paramData(ast: Ast, param: Ast.full.FnProto.Param) ParamData {
+    return ParamData{
+        .name_token = param.name_token orelse INVALID_TOKEN,
+        .type_expr = param.type_expr,
+        .info = ParamDataInfo{
+            .is_comptime = if (param.comptime_noalias) |tok| isTokenSliceEql(ast, tok, "comptime") else false,
+            .is_noalias = if (param.comptime_noalias) |tok| isTokenSliceEql(ast, tok, "noalias") else false,
+            .is_anytype = if (param.anytype_ellipsis3) |tok| isTokenSliceEql(ast, tok, "anytype") else false,
+            .is_vararg = if (param.anytype_ellipsis3) |tok| isTokenSliceEql(ast, tok, "...") else false,
+        },
+    };
+}
+
 export fn ast_fn_param_at(ptr: ?*ZAst, index: NodeIndex, i: u32) ParamData {
     if (ptr) |zast| {
         if (index < zast.ast.nodes.len) {
@@ -1002,16 +3040,7 @@ export fn ast_fn_param_at(ptr: ?*ZAst, index: NodeIndex, i: u32) ParamData {
                 var j: u32 = 0;
                 while (iter.next()) |param| {
                     if (j == i) {
-                        return ParamData{
-                            .name_token = param.name_token orelse INVALID_TOKEN,
-                            .type_expr = param.type_expr,
-                            .info = ParamDataInfo{
-                                .is_comptime = if (param.comptime_noalias) |tok| isTokenSliceEql(zast.ast, tok, "comptime") else false,
-                                .is_noalias = if (param.comptime_noalias) |tok| isTokenSliceEql(zast.ast, tok, "noalias") else false,
-                                .is_anytype = if (param.anytype_ellipsis3) |tok| isTokenSliceEql(zast.ast, tok, "anytype") else false,
-                                .is_vararg = if (param.anytype_ellipsis3) |tok| isTokenSliceEql(zast.ast, tok, "...") else false,
-                            },
-                        };
+                        return paramData(zast.ast, param);
                     }
                     j += 1;
                 }
@@ -1021,6 +3050,26 @@ export fn ast_fn_param_at(ptr: ?*ZAst, index: NodeIndex, i: u32) ParamData {
     return ParamData{};
 }
 
+// All params in a single pass over the proto, see fillBuffer
+export fn ast_fn_params(ptr: ?*ZAst, index: NodeIndex, out: ?[*]ParamData, cap: u32) u32 {
+    if (ptr) |zast| {
+        if (index < zast.ast.nodes.len) {
+            var buffer: [1]Ast.Node.Index = undefined;
+            if (zast.ast.fullFnProto(&buffer, index)) |proto| {
+                var iter = proto.iterate(&zast.ast);
+                var n: u32 = 0;
+                while (iter.next()) |param| : (n += 1) {
+                    if (out != null and n < cap) {
+                        out.?[n] = paramData(zast.ast, param);
+                    }
+                }
+                return n;
+            }
+        }
+    }
+    return 0;
+}
+
 export fn ast_struct_init_field_count(ptr: ?*ZAst, index: NodeIndex) u32 {
     if (ptr) |zast| {
         if (index < zast.ast.nodes.len) {
@@ -1039,18 +3088,21 @@ const FieldInitData = extern struct {
     value_expr: NodeIndex = 0,
 };
 
+fn fieldInitData(ast: Ast, field: NodeIndex) FieldInitData {
+    return FieldInitData{
+        // TODO: Is this valid for every case???
+        .name_token=ast.firstToken(field) -| 2,
+        .value_expr=field
+    };
+}
+
 export fn ast_struct_init_field_at(ptr: ?*ZAst, index: NodeIndex, i: u32) FieldInitData {
     if (ptr) |zast| {
         if (index < zast.ast.nodes.len) {
             var buffer: [2]Ast.Node.Index = undefined;
             if (zast.ast.fullStructInit(&buffer, index)) |struct_data| {
                 if (i < struct_data.ast.fields.len) {
-                    const f = struct_data.ast.fields[i];
-                    return FieldInitData{
-                        // TODO: Is this valid for every case???
-                        .name_token=zast.ast.firstToken(f) -| 2,
-                        .value_expr=f
-                    };
+                    return fieldInitData(zast.ast, struct_data.ast.fields[i]);
                 }
             }
         }
@@ -1058,6 +3110,24 @@ export fn ast_struct_init_field_at(ptr: ?*ZAst, index: NodeIndex, i: u32) FieldI
     return FieldInitData{};
 }
 
+export fn ast_struct_init_fields(ptr: ?*ZAst, index: NodeIndex, out: ?[*]FieldInitData, cap: u32) u32 {
+    if (ptr) |zast| {
+        if (index < zast.ast.nodes.len) {
+            var buffer: [2]Ast.Node.Index = undefined;
+            if (zast.ast.fullStructInit(&buffer, index)) |struct_data| {
+                const fields = struct_data.ast.fields;
+                if (out) |dst| {
+                    for (fields[0..@min(cap, fields.len)], 0..) |f, i| {
+                        dst[i] = fieldInitData(zast.ast, f);
+                    }
+                }
+                return @intCast(fields.len);
+            }
+        }
+    }
+    return 0;
+}
+
 // Note: 0 is a valid token
 export fn ast_node_main_token(ptr: ?*ZAst, index: NodeIndex) TokenIndex {
     if (ptr) |zast| {
@@ -1254,28 +3324,78 @@ test "spelling-range" {
     try testSpellingRange("var x = @min(1, 2);", .builtin_call_two, .{ .start = .{ .line = 0, .column = 8 }, .end = .{ .line = 0, .column = 12 } });
 }
 
+// Render the ast like zig fmt. Trees with errors are not rendered
+// since the output would drop or mangle the invalid parts.
+fn renderFormatted(allocator: Allocator, ast: Ast, out_len: ?*u32) ?[*]const u8 {
+    if (ast.errors.len > 0) {
+        return null;
+    }
+    const formatted = ast.render(allocator) catch |err| {
+        std.log.warn("zig: format error: {}\n", .{err});
+        return null;
+    };
+    if (out_len) |len| {
+        len.* = @intCast(formatted.len);
+    }
+    return formatted.ptr;
+}
+
+// Format source in-process, the result must be freed with destroy_formatted
 export fn ast_format(
     source_ptr: [*c]const u8,
+    source_len: u32,
+    is_terminated: bool,
+    out_len: ?*u32,
 ) ?[*]const u8 {
-    if (source_ptr == null) {
+    if (source_ptr == null or source_len == 0) {
         return null;
     }
-    const source_len = strlen(source_ptr);
-    if (source_len == 0) {
-        return null;
-    }
-    const source: [:0]const u8 = source_ptr[0..source_len :0];
-    const allocator = gpa.allocator();
-    var ast = Ast.parse(allocator, source, .zig) catch |err| {
+    const allocator = globalAllocator();
+    const source = terminatedSource(allocator, source_ptr, source_len, is_terminated) catch |err| {
         std.log.warn("zig: format error: {}\n", .{err});
         return null;
     };
-    defer ast.deinit(allocator);
-    const formatted = ast.render(allocator) catch |err| {
+    defer if (source.ptr != source_ptr) allocator.free(source);
+    var ast = Ast.parse(allocator, source, .zig) catch |err| {
         std.log.warn("zig: format error: {}\n", .{err});
         return null;
     };
-    return formatted.ptr;
+    defer ast.deinit(allocator);
+    return renderFormatted(allocator, ast, out_len);
+}
+
+// Format an already parsed tree, the result must be freed with destroy_formatted
+export fn ast_render(ptr: ?*ZAst, out_len: ?*u32) ?[*]const u8 {
+    if (ptr) |zast| {
+        return renderFormatted(globalAllocator(), zast.ast, out_len);
+    }
+    return null;
+}
+
+export fn destroy_formatted(ptr: ?[*]const u8, len: u32) void {
+    if (ptr) |formatted| {
+        globalAllocator().free(formatted[0..len]);
+    }
+}
+
+test "format" {
+    const source = "const  x=1;\nfn foo( ) void{}\n";
+    const expected = "const x = 1;\nfn foo() void {}\n";
+    var len: u32 = 0;
+    const formatted = ast_format(source.ptr, source.len, true, &len).?;
+    defer destroy_formatted(formatted, len);
+    try std.testing.expectEqualStrings(expected, formatted[0..len]);
+
+    var zast = try ZAst.parse(std.testing.allocator, source);
+    defer zast.deinit(std.testing.allocator);
+    var rendered_len: u32 = 0;
+    const rendered = ast_render(&zast, &rendered_len).?;
+    defer destroy_formatted(rendered, rendered_len);
+    try std.testing.expectEqualStrings(expected, rendered[0..rendered_len]);
+
+    // Invalid source is left alone
+    const invalid = "const x = ;";
+    try std.testing.expect(ast_format(invalid.ptr, invalid.len, true, &len) == null);
 }
 
 const NodeData = extern struct {
@@ -1283,6 +3403,92 @@ const NodeData = extern struct {
     rhs: NodeIndex = 0,
 };
 
+export fn ast_view(ptr: ?*ZAst) ?*const AstView {
+    if (ptr) |zast| {
+        return &zast.view;
+    }
+    return null;
+}
+
+// Offset of the view within the ZAst so C++ can find it without a call
+export fn ast_view_offset() usize {
+    return @offsetOf(ZAst, "view");
+}
+
+test "ast-view" {
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator, "const x = foo(1, 2);");
+    defer zast.deinit(allocator);
+    const view = ast_view(&zast).?;
+    try std.testing.expectEqual(zast.ast.nodes.len, view.node_count);
+    try std.testing.expectEqual(zast.ast.tokens.len, view.token_count);
+    try std.testing.expectEqual(zast.ast.extra_data.len, view.extra_data_count);
+    const base: [*]const u8 = @ptrCast(&zast);
+    const offset_view: *const AstView = @ptrCast(@alignCast(base + ast_view_offset()));
+    try std.testing.expectEqual(view, offset_view);
+    for (0..zast.ast.nodes.len) |i| {
+        const index: NodeIndex = @intCast(i);
+        try std.testing.expectEqual(ast_node_tag(&zast, index), view.node_tags.?[i]);
+        try std.testing.expectEqual(ast_node_data(&zast, index), view.node_data.?[i]);
+        try std.testing.expectEqual(ast_node_main_token(&zast, index), view.node_main_tokens.?[i]);
+    }
+    for (0..zast.ast.tokens.len) |i| {
+        try std.testing.expectEqual(@intFromEnum(zast.ast.tokens.items(.tag)[i]), view.token_tags.?[i]);
+        try std.testing.expectEqual(zast.ast.tokens.items(.start)[i], view.token_starts.?[i]);
+    }
+}
+
+export fn ast_token_ident_id(ptr: ?*ZAst, token: TokenIndex) u32 {
+    if (ptr) |zast| {
+        if (token < zast.token_idents.len) {
+            return zast.token_idents[token];
+        }
+    }
+    return ZAst.no_ident;
+}
+
+export fn ast_ident_count(ptr: ?*ZAst) u32 {
+    if (ptr) |zast| {
+        return @intCast(zast.ident_tokens.len);
+    }
+    return 0;
+}
+
+export fn ast_ident_slice(ptr: ?*ZAst, id: u32) SourceSlice {
+    if (ptr) |zast| {
+        if (id < zast.ident_tokens.len) {
+            const name = zast.ast.tokenSlice(zast.ident_tokens[id]);
+            return SourceSlice{ .data = name.ptr, .len = @intCast(name.len) };
+        }
+    }
+    return SourceSlice{};
+}
+
+test "ident-ids" {
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator,
+        \const a = b + a;
+        \fn b(c: u8) u8 { return c + a; }
+    );
+    defer zast.deinit(allocator);
+    // a, b, c, u8
+    try std.testing.expectEqual(4, ast_ident_count(&zast));
+    var ids = [_]u32{0} ** 4;
+    for (zast.ast.tokens.items(.tag), 0..) |tag, i| {
+        const token: TokenIndex = @intCast(i);
+        const id = ast_token_ident_id(&zast, token);
+        if (tag != .identifier) {
+            try std.testing.expectEqual(ZAst.no_ident, id);
+            continue;
+        }
+        const name = ast_ident_slice(&zast, id);
+        try std.testing.expectEqualStrings(zast.ast.tokenSlice(token), name.data.?[0..name.len]);
+        ids[id] += 1;
+    }
+    try std.testing.expectEqualSlices(u32, &.{ 3, 2, 2, 2 }, &ids);
+    try std.testing.expectEqual(zast.view.ident_count, ast_ident_count(&zast));
+}
+
 // Visit one child
 export fn ast_node_data(ptr: ?*ZAst, node: NodeIndex) NodeData {
     if (ptr) |zast| {
@@ -1462,6 +3668,18 @@ export fn ast_array_init_item_at(ptr: ?*ZAst, node: NodeIndex, i: u32) NodeIndex
     return 0;
 }
 
+export fn ast_array_init_items(ptr: ?*ZAst, node: NodeIndex, out: ?[*]NodeIndex, cap: u32) u32 {
+    if (ptr) |zast| {
+        if (node < zast.ast.nodes.len) {
+            var nodes: [2]Ast.Node.Index = undefined;
+            if (zast.ast.fullArrayInit(&nodes, node)) |array_data| {
+                return fillBuffer(NodeIndex, out, cap, array_data.ast.elements);
+            }
+        }
+    }
+    return 0;
+}
+
 const SubRange = extern struct {
     start: NodeIndex = 0,
     end: NodeIndex = 0
@@ -1533,6 +3751,17 @@ export fn ast_switch_case_item_at(ptr: ?*ZAst, node: NodeIndex, i: u32) NodeInde
     return 0;
 }
 
+export fn ast_switch_case_items(ptr: ?*ZAst, node: NodeIndex, out: ?[*]NodeIndex, cap: u32) u32 {
+    if (ptr) |zast| {
+        if (node < zast.ast.nodes.len) {
+            if (zast.ast.fullSwitchCase(node)) |switch_case| {
+                return fillBuffer(NodeIndex, out, cap, switch_case.ast.values);
+            }
+        }
+    }
+    return 0;
+}
+
 export fn ast_for_input_count(ptr: ?*ZAst, node: NodeIndex) u32 {
     if (ptr) |zast| {
         if (node < zast.ast.nodes.len) {
@@ -1557,20 +3786,87 @@ export fn ast_for_input_at(ptr: ?*ZAst, node: NodeIndex, i: u32) NodeIndex {
     return 0;
 }
 
-fn visitOne(zast: *const ZAst, node: NodeIndex, parent: NodeIndex, data: *NodeIndex) VisitResult {
-    _ = zast;
-    _ = parent;
-    data.* = node;
-    return .Break;
+export fn ast_for_inputs(ptr: ?*ZAst, node: NodeIndex, out: ?[*]NodeIndex, cap: u32) u32 {
+    if (ptr) |zast| {
+        if (node < zast.ast.nodes.len) {
+            if (zast.ast.fullFor(node)) |for_data| {
+                return fillBuffer(NodeIndex, out, cap, for_data.ast.inputs);
+            }
+        }
+    }
+    return 0;
+}
+
+test "bulk-accessors" {
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator,
+        \\fn foo(comptime a: u8, b: anytype, c: u32) void {
+        \\    bar(a, b, c, 1);
+        \\    const x = S{ .a = 1, .b = 2 };
+        \\    for (x, 0..) |_, _| {}
+        \\    switch (a) { 1, 2, 3 => {}, else => {} }
+        \\}
+    );
+    defer zast.deinit(allocator);
+
+    const fn_proto = indexOfNodeWithTag(zast.ast, 0, .fn_proto_multi).?;
+    var params: [2]ParamData = undefined;
+    // A short buffer still reports the total count
+    try std.testing.expectEqual(3, ast_fn_params(&zast, fn_proto, &params, params.len));
+    try std.testing.expectEqual(ast_fn_param_count(&zast, fn_proto), ast_fn_params(&zast, fn_proto, null, 0));
+    for (params, 0..) |p, i| {
+        try std.testing.expectEqual(ast_fn_param_at(&zast, fn_proto, @intCast(i)), p);
+    }
+    try std.testing.expect(params[0].info.is_comptime);
+
+    const call = indexOfNodeWithTag(zast.ast, 0, .call).?;
+    var args: [8]NodeIndex = undefined;
+    const n = ast_call_args(&zast, call, &args, args.len);
+    try std.testing.expectEqual(4, n);
+    for (args[0..n], 0..) |arg, i| {
+        try std.testing.expectEqual(ast_call_arg_at(&zast, call, @intCast(i)), arg);
+    }
+
+    const init = indexOfNodeWithTag(zast.ast, 0, .struct_init_two).?;
+    var fields: [4]FieldInitData = undefined;
+    try std.testing.expectEqual(2, ast_struct_init_fields(&zast, init, &fields, fields.len));
+    try std.testing.expectEqual(ast_struct_init_field_at(&zast, init, 1), fields[1]);
+
+    const for_node = indexOfNodeWithTag(zast.ast, 0, .@"for").?;
+    try std.testing.expectEqual(2, ast_for_inputs(&zast, for_node, &args, args.len));
+    try std.testing.expectEqual(ast_for_input_at(&zast, for_node, 1), args[1]);
+
+    const case = indexOfNodeWithTag(zast.ast, 0, .switch_case).?;
+    try std.testing.expectEqual(3, ast_switch_case_items(&zast, case, &args, args.len));
+    try std.testing.expectEqual(ast_switch_case_item_at(&zast, case, 2), args[2]);
 }
 
 // Visit one child
 export fn ast_visit_one_child(ptr: ?*ZAst, node: NodeIndex) NodeIndex {
-    var result: NodeIndex = 0;
     if (ptr) |zast| {
-        visit(zast, node, *NodeIndex, visitOne, &result);
+        if (node < zast.ast.nodes.len) {
+            const nodes = zast.children(node);
+            if (nodes.len > 0) {
+                return nodes[0];
+            }
+        }
     }
-    return result;
+    return 0;
+}
+
+const NodeSpan = extern struct {
+    data: ?[*]const NodeIndex = null,
+    len: u32 = 0,
+};
+
+export fn ast_children(ptr: ?*ZAst, node: NodeIndex) NodeSpan {
+    if (ptr) |zast| {
+        if (node < zast.ast.nodes.len) {
+            const nodes = zast.children(node);
+            return NodeSpan{.data = nodes.ptr, .len = @intCast(nodes.len)};
+        }
+    }
+    return NodeSpan{};
 }
 
 fn visitAll(zast: *const ZAst, child: NodeIndex, parent: NodeIndex, nodes: *std.ArrayList(NodeIndex)) VisitResult {
@@ -2181,6 +4477,13 @@ pub fn visit(
     return;
 }
 
+fn collectChildIndex(zast: *const ZAst, node: NodeIndex, nodes: *std.ArrayList(NodeIndex)) !void {
+    for (zast.children(node)) |child| {
+        try nodes.append(child);
+        try collectChildIndex(zast, child, nodes);
+    }
+}
+
 fn testVisit(source: [:0]const u8, tag: Tag) !void {
     const allocator = std.testing.allocator;
     var zast = try ZAst.parse(allocator, source);
@@ -2206,35 +4509,18 @@ fn testVisit(source: [:0]const u8, tag: Tag) !void {
     // try dumpAstNodes(&ast, visited, stdout);
     try std.testing.expectEqual(zast.ast.nodes.len, visited.len);
 
+    // The child index must produce the same order
+    var indexed = try std.ArrayList(NodeIndex).initCapacity(allocator, zast.ast.nodes.len);
+    defer indexed.deinit();
+    try collectChildIndex(&zast, 0, &indexed);
+    try std.testing.expectEqualSlices(NodeIndex, visited[1..], indexed.items);
+
     // Sort visited nodes and make sure each was hit
     std.mem.sort(NodeIndex, visited, {}, std.sort.asc(NodeIndex));
     for (visited, 0..) |a, b| {
         try std.testing.expectEqual(@as(NodeIndex, @intCast(b)), a);
     }
 
-//     var timer = try std.time.Timer.start();
-//     for (0..ast.tokens.len) |i| {
-//         _ = ast.fastTokenLocation(@intCast(i));
-//     }
-//     const t0: f64 = @floatFromInt(timer.read());
-//     std.log.warn("Old: {d:6.2}ms", .{std.math.round(t0/std.time.ms_per_s)});
-//
-//     timer.reset();
-//     for (0..ast.tokens.len) |i| {
-//         _ = ast.fastTokenLocation(@intCast(i));
-//     }
-//     const t1: f64 = @floatFromInt(timer.read());
-//     std.log.warn("New: {d:6.2}ms", .{std.math.round(t1/std.time.ms_per_s)});
-//     const dt = t1-t0;
-//     std.log.warn("Diff: delta={d:6.2}ms {d:6.2}% {s}", .{
-//         dt/std.time.ms_per_s, 100*(t1-t0)/t0, if (t1 < t0) "faster" else "slower"});
-//
-//     for (0..ast.tokens.len) |i| {
-//         const a = ast.fastTokenLocation(@intCast(i));
-//         const b = ast.fastTokenLocationScan(0, @intCast(i));
-//         try std.testing.expectEqual(a, b);
-//     }
-
     // If given, make sure the tag is actually used in the source parsed
     if (indexOfNodeWithTag(zast.ast, 0, tag) == null) {
         std.log.err("Expected tag {} not found in ast\n", .{tag});
@@ -2463,143 +4749,234 @@ test "ast-visit" {
 //     }
 // }
 
-const BUILTIN_FN_NAMES = [_][:0]const u8{
-    "@addrSpaceCast",
-    "@addWithOverflow",
-    "@alignCast",
-    "@alignOf",
-    "@as",
-    "@atomicLoad",
-    "@atomicRmw",
-    "@atomicStore",
-    "@bitCast",
-    "@bitOffsetOf",
-    "@bitSizeOf",
-    "@branchHint",
-    "@breakpoint",
-    "@mulAdd",
-    "@byteSwap",
-    "@bitReverse",
-    "@offsetOf",
-    "@call",
-    "@cDefine",
-    "@cImport",
-    "@cInclude",
-    "@clz",
-    "@cmpxchgStrong",
-    "@cmpxchgWeak",
-    "@compileError",
-    "@compileLog",
-    "@constCast",
-    "@ctz",
-    "@cUndef",
-    "@cVaArg",
-    "@cVaCopy",
-    "@cVaEnd",
-    "@cVaStart",
-    "@divExact",
-    "@divFloor",
-    "@divTrunc",
-    "@embedFile",
-    "@enumFromInt",
-    "@errorFromInt",
-    "@errorName",
-    "@errorReturnTrace",
-    "@errorCast",
-    "@export",
-    "@extern",
-    "@fence",
-    "@field",
-    "@fieldParentPtr",
-    "@floatCast",
-    "@floatFromInt",
-    "@frameAddress",
-    "@hasDecl",
-    "@hasField",
-    "@import",
-    "@inComptime",
-    "@intCast",
-    "@intFromBool",
-    "@intFromEnum",
-    "@intFromError",
-    "@intFromFloat",
-    "@intFromPtr",
-    "@max",
-    "@memcpy",
-    "@memset",
-    "@min",
-    "@wasmMemorySize",
-    "@wasmMemoryGrow",
-    "@mod",
-    "@mulWithOverflow",
-    "@panic",
-    "@popCount",
-    "@prefetch",
-    "@ptrCast",
-    "@ptrFromInt",
-    "@rem",
-    "@returnAddress",
-    "@select",
-    "@setAlignStack",
-    "@setCold",
-    "@setEvalBranchQuota",
-    "@setFloatMode",
-    "@setRuntimeSafety",
-    "@shlExact",
-    "@shlWithOverflow",
-    "@shrExact",
-    "@shuffle",
-    "@sizeOf",
-    "@splat",
-    "@reduce",
-    "@src",
-    "@sqrt",
-    "@sin",
-    "@cos",
-    "@tan",
-    "@exp",
-    "@exp2",
-    "@log",
-    "@log2",
-    "@log10",
-    "@abs",
-    "@floor",
-    "@ceil",
-    "@trunc",
-    "@round",
-    "@subWithOverflow",
-    "@tagName",
-    "@This",
-    "@trap",
-    "@truncate",
-    "@Type",
-    "@typeInfo",
-    "@typeName",
-    "@TypeOf",
-    "@unionInit",
-    "@Vector",
-    "@volatileCast",
-    "@workGroupId",
-    "@workGroupSize",
-    "@workItemId"
+// Stable ids of builtin functions shared with C++ as BuiltinFnId.
+// New builtins must only be appended so the ids do not change.
+const BuiltinFnId = enum(u8) {
+    invalid = 0,
+    addrSpaceCast,
+    addWithOverflow,
+    alignCast,
+    alignOf,
+    as,
+    atomicLoad,
+    atomicRmw,
+    atomicStore,
+    bitCast,
+    bitOffsetOf,
+    bitSizeOf,
+    branchHint,
+    breakpoint,
+    mulAdd,
+    byteSwap,
+    bitReverse,
+    offsetOf,
+    call,
+    cDefine,
+    cImport,
+    cInclude,
+    clz,
+    cmpxchgStrong,
+    cmpxchgWeak,
+    compileError,
+    compileLog,
+    constCast,
+    ctz,
+    cUndef,
+    cVaArg,
+    cVaCopy,
+    cVaEnd,
+    cVaStart,
+    divExact,
+    divFloor,
+    divTrunc,
+    embedFile,
+    enumFromInt,
+    errorFromInt,
+    errorName,
+    errorReturnTrace,
+    errorCast,
+    @"export",
+    @"extern",
+    fence,
+    field,
+    fieldParentPtr,
+    floatCast,
+    floatFromInt,
+    frameAddress,
+    hasDecl,
+    hasField,
+    import,
+    inComptime,
+    intCast,
+    intFromBool,
+    intFromEnum,
+    intFromError,
+    intFromFloat,
+    intFromPtr,
+    max,
+    memcpy,
+    memset,
+    min,
+    wasmMemorySize,
+    wasmMemoryGrow,
+    mod,
+    mulWithOverflow,
+    panic,
+    popCount,
+    prefetch,
+    ptrCast,
+    ptrFromInt,
+    rem,
+    returnAddress,
+    select,
+    setAlignStack,
+    setCold,
+    setEvalBranchQuota,
+    setFloatMode,
+    setRuntimeSafety,
+    shlExact,
+    shlWithOverflow,
+    shrExact,
+    shuffle,
+    sizeOf,
+    splat,
+    reduce,
+    src,
+    sqrt,
+    sin,
+    cos,
+    tan,
+    exp,
+    exp2,
+    log,
+    log2,
+    log10,
+    abs,
+    floor,
+    ceil,
+    trunc,
+    round,
+    subWithOverflow,
+    tagName,
+    This,
+    trap,
+    truncate,
+    Type,
+    typeInfo,
+    typeName,
+    TypeOf,
+    unionInit,
+    Vector,
+    volatileCast,
+    workGroupId,
+    workGroupSize,
+    workItemId,
+    FieldType,
+    disableInstrumentation,
 };
 
-export fn is_zig_builtin_fn_name(ptr: [*c]const u8) bool {
-    const len = strlen(ptr);
-    if (len > 0) {
-        // TODO: Pull from BuiltinFn.zig
-        const name = ptr[0..len];
-        for (BUILTIN_FN_NAMES) |n| {
-            if (std.mem.eql(u8, name, n)) {
-                return true;
+// Comptime generated perfect hash from builtin name to id. The slot of
+// each name is unique so a lookup is one hash and one string compare.
+const BuiltinFnTable = struct {
+    const bits = 12;
+    const size = 1 << bits;
+    const fields = std.meta.fields(BuiltinFnId);
+
+    const names = blk: {
+        var result: [fields.len][:0]const u8 = undefined;
+        result[0] = "";
+        for (fields[1..], 1..) |f, i| {
+            std.debug.assert(f.value == i);
+            result[i] = "@" ++ f.name;
+        }
+        break :blk result;
+    };
+
+    const table = blk: {
+        @setEvalBranchQuota(10_000_000);
+        var s: u32 = 0;
+        while (true) : (s += 1) {
+            var slots = [_]BuiltinFnId{.invalid} ** size;
+            for (fields[1..]) |f| {
+                const i = slot(names[f.value], s);
+                if (slots[i] != .invalid) {
+                    break;
+                }
+                slots[i] = @enumFromInt(f.value);
+            } else {
+                break :blk .{ .seed = s, .ids = slots };
             }
         }
+    };
+
+    fn slot(name: []const u8, s: u32) usize {
+        var h: u32 = 2166136261 ^ s;
+        for (name) |c| {
+            h = (h ^ c) *% 16777619;
+        }
+        return (h *% 0x9E3779B1) >> (32 - bits);
+    }
+
+    pub fn lookup(name: []const u8) BuiltinFnId {
+        const id = table.ids[slot(name, table.seed)];
+        if (id != .invalid and std.mem.eql(u8, names[@intFromEnum(id)], name)) {
+            return id;
+        }
+        return .invalid;
+    }
+};
+
+export fn is_zig_builtin_fn_name(ptr: [*c]const u8, len: u32) bool {
+    if (ptr != null and len > 0) {
+        return BuiltinFnTable.lookup(ptr[0..len]) != .invalid;
     }
     return false;
 }
 
+export fn ast_builtin_id(ptr: ?*ZAst, index: NodeIndex) u32 {
+    if (ptr) |zast| {
+        if (index < zast.ast.nodes.len) {
+            const tag = zast.ast.nodes.items(.tag)[index];
+            switch (tag) {
+                .builtin_call, .builtin_call_comma, .builtin_call_two, .builtin_call_two_comma => {
+                    const token = zast.ast.nodes.items(.main_token)[index];
+                    return @intFromEnum(BuiltinFnTable.lookup(zast.ast.tokenSlice(token)));
+                },
+                else => {},
+            }
+        }
+    }
+    return @intFromEnum(BuiltinFnId.invalid);
+}
+
+test "builtin-fn-table" {
+    // Every builtin known to this version of zig must have an id
+    for (std.zig.BuiltinFn.list.keys()) |name| {
+        if (BuiltinFnTable.lookup(name) == .invalid) {
+            std.log.warn("Missing builtin id for {s}", .{name});
+            return error.TestUnexpectedResult;
+        }
+    }
+    for (BuiltinFnTable.names[1..], 1..) |name, i| {
+        try std.testing.expectEqual(i, @intFromEnum(BuiltinFnTable.lookup(name)));
+    }
+    try std.testing.expectEqual(BuiltinFnId.invalid, BuiltinFnTable.lookup("@"));
+    try std.testing.expectEqual(BuiltinFnId.invalid, BuiltinFnTable.lookup("@minimum"));
+    try std.testing.expectEqual(BuiltinFnId.This, BuiltinFnTable.lookup("@This"));
+    try std.testing.expectEqual(BuiltinFnId.@"export", BuiltinFnTable.lookup("@export"));
+
+    const allocator = std.testing.allocator;
+    var zast = try ZAst.parse(allocator, "const std = @import(\"std\");");
+    defer zast.deinit(allocator);
+    const n = indexOfNodeWithTag(zast.ast, 0, .builtin_call_two).?;
+    try std.testing.expectEqual(@intFromEnum(BuiltinFnId.import), ast_builtin_id(&zast, n));
+    try std.testing.expectEqual(@intFromEnum(BuiltinFnId.invalid), ast_builtin_id(&zast, 0));
+}
+
 test "is_zig_builtin_fn_name" {
-    try std.testing.expectEqual(true, is_zig_builtin_fn_name("@min"));
-    try std.testing.expectEqual(false, is_zig_builtin_fn_name("@foo"));
-    try std.testing.expectEqual(false, is_zig_builtin_fn_name(""));
+    try std.testing.expectEqual(true, is_zig_builtin_fn_name("@min", 4));
+    try std.testing.expectEqual(false, is_zig_builtin_fn_name("@foo", 4));
+    try std.testing.expectEqual(false, is_zig_builtin_fn_name("", 0));
+    // Only the given length is used
+    try std.testing.expectEqual(true, is_zig_builtin_fn_name("@minimum", 4));
 }
@@ -17,12 +17,83 @@
  */
 
 #include "parsesession.h"
+#include <QAtomicInt>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
 #include <interfaces/icore.h>
 #include <interfaces/iprojectcontroller.h>
+#include <language/duchain/topducontext.h>
 
 namespace Zig
 {
 
+namespace {
+
+// Once the cache grows past this the files written longest ago are removed
+constexpr qint64 maxAstCacheBytes = 512 * 1024 * 1024;
+// Listing the cache is not free so it is only pruned every so many writes
+constexpr int astCachePruneInterval = 64;
+
+QString astCacheDir()
+{
+    static const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return cacheDir.isEmpty() ? QString() : cacheDir + QStringLiteral("/zig-ast");
+}
+
+void pruneAstCache(const QString &dirPath)
+{
+    QDir dir(dirPath);
+    // Newest first
+    const QFileInfoList files = dir.entryInfoList({QStringLiteral("*.zast")}, QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo &file : files) {
+        total += file.size();
+        if (total > maxAstCacheBytes) {
+            QFile::remove(file.filePath());
+        }
+    }
+}
+
+// Cache files are written and pruned by a single thread so parse jobs
+// do not wait on the disk. Never destroyed so exiting does not wait on it.
+QThreadPool *astCacheWriter()
+{
+    static QThreadPool *pool = [] {
+        auto *pool = new QThreadPool;
+        pool->setMaxThreadCount(1);
+        return pool;
+    }();
+    return pool;
+}
+
+void writeAstCache(ZAst *ast, uint64_t key, const QString &path)
+{
+    uint32_t len = 0;
+    const char *data = ast_cache_data(ast, key, &len);
+    if (!data) {
+        return;
+    }
+    astCacheWriter()->start([data, len, path] {
+        static QAtomicInt writes;
+        const QString dirPath = astCacheDir();
+        if (writes.fetchAndAddRelaxed(1) % astCachePruneInterval == 0) {
+            pruneAstCache(dirPath);
+        }
+        // The rename on commit keeps a reader from mapping
+        // a partially written file
+        QSaveFile file(path);
+        if (QDir().mkpath(dirPath) && file.open(QIODevice::WriteOnly)
+                && file.write(data, len) == qint64(len)) {
+            file.commit();
+        }
+        destroy_cache_data(data, len);
+    });
+}
+
+}
+
 ParseSessionData::ParseSessionData(const KDevelop::IndexedString &document,
                                    const QByteArray &contents,
                                    const KDevelop::ParseJob *job,
@@ -32,6 +103,7 @@ ParseSessionData::ParseSessionData(const KDevelop::IndexedString &document,
       ,m_ast(nullptr)
       ,m_jobPriority(priority)
       ,m_job(job)
+      ,m_astCacheEnabled(false)
 {
     m_project = KDevelop::ICore::self()->projectController()->findProjectForUrl(
         QUrl::fromLocalFile(document.str())
@@ -47,9 +119,99 @@ ParseSessionData::~ParseSessionData()
     m_job = nullptr;
 }
 
-void ParseSessionData::parse()
+QString ParseSessionData::astCachePath(ParseMode mode, uint64_t &key) const
+{
+    // Only files outside of a project (the std lib and packages) that are
+    // not open are cached, anything else changes too often to be worth it
+    if (!m_astCacheEnabled || m_project || m_contents.isEmpty()
+            || qEnvironmentVariableIsSet("KDEV_ZIG_DISABLE_AST_CACHE")) {
+        return QString();
+    }
+    const QString cacheDir = astCacheDir();
+    if (cacheDir.isEmpty()) {
+        return QString();
+    }
+    key = ast_cache_key(m_contents.constData(), m_contents.size(), mode);
+    return QStringLiteral("%1/%2.zast").arg(cacheDir, QString::number(key, 16));
+}
+
+void ParseSessionData::parse(ParseMode mode)
+{
+    // Return the previous ast to the parser's pool before reparsing
+    if (m_ast != nullptr) {
+        destroy_ast(m_ast);
+        m_ast = nullptr;
+    }
+    m_identifiers.clear();
+    m_unchangedBodies.clear();
+
+    uint64_t cacheKey = 0;
+    const QByteArray cachePath = astCachePath(mode, cacheKey).toUtf8();
+    if (!cachePath.isEmpty()) {
+        m_ast = ast_cache_load(
+            m_document.c_str(), m_document.length(),
+            cachePath.constData(), cachePath.size(),
+            m_contents.constData(), m_contents.size(), true, cacheKey, mode);
+    }
+
+    if (!m_ast) {
+        // The ast borrows m_contents which is implicitly shared with the
+        // job's contents so the document is not copied
+        m_ast = parse_ast(m_document.c_str(), m_document.length(), m_contents.constData(), m_contents.size(), true, false, mode);
+        if (m_ast && !cachePath.isEmpty() && ast_error_count(m_ast) == 0) {
+            writeAstCache(m_ast, cacheKey, QString::fromUtf8(cachePath));
+        }
+    }
+    resetNodeTables();
+}
+
+void ParseSessionData::reparse(const ParseSessionData &previous)
+{
+    if (!previous.m_ast || previous.m_contents == m_contents) {
+        parse(ParseMode_Full);
+        return;
+    }
+    // The edit is the range between the common prefix and suffix
+    const qsizetype oldSize = previous.m_contents.size();
+    const qsizetype newSize = m_contents.size();
+    const qsizetype maxLen = qMin(oldSize, newSize);
+    qsizetype prefix = 0;
+    while (prefix < maxLen && previous.m_contents[prefix] == m_contents[prefix]) {
+        prefix++;
+    }
+    qsizetype suffix = 0;
+    while (suffix < maxLen - prefix
+            && previous.m_contents[oldSize - suffix - 1] == m_contents[newSize - suffix - 1]) {
+        suffix++;
+    }
+
+    if (m_ast != nullptr) {
+        destroy_ast(m_ast);
+        m_ast = nullptr;
+    }
+    m_identifiers.clear();
+    m_unchangedBodies.clear();
+    m_ast = reparse_ast(previous.m_ast, prefix, oldSize - suffix,
+                        m_contents.constData(), m_contents.size(), true);
+    if (!m_ast) {
+        parse(ParseMode_Full);
+        return;
+    }
+    const NodeSpan bodies = ast_unchanged_bodies(m_ast);
+    for (uint32_t i = 0; i < bodies.len; i++) {
+        m_unchangedBodies.insert(bodies.data[i]);
+    }
+    resetNodeTables();
+}
+
+void ParseSessionData::resetNodeTables()
 {
-    m_ast = parse_ast(m_document.c_str(), m_contents.constData());
+    const uint32_t nodeCount = m_ast ? ast_view(m_ast)->node_count : 0;
+    m_nodeContexts.reset(nodeCount);
+    m_nodeTypes.reset(nodeCount);
+    m_nodeDecls.reset(nodeCount);
+    m_expressions.reset(nodeCount);
+    m_expressionStats = ExpressionCacheStats();
 }
 
 KDevelop::IndexedString ParseSession::languageString()
@@ -68,10 +230,40 @@ ParseSession::~ParseSession()
 {
 }
 
-void ParseSession::parse()
+void ParseSession::parse(ParseMode mode)
+{
+    clearUnresolvedImports();
+    d->parse(mode);
+}
+
+const CachedIdentifier &ParseSession::identifier(const ZigNode &node, TokenIndex token)
+{
+    static const CachedIdentifier invalid;
+    const uint32_t id = node.identId(token);
+    if (id == INVALID_IDENT || node.ast != d->m_ast) {
+        return invalid;
+    }
+    if (d->m_identifiers.isEmpty()) {
+        d->m_identifiers.resize(ast_ident_count(d->m_ast));
+    }
+    CachedIdentifier &entry = d->m_identifiers[id];
+    if (!entry.isValid()) {
+        const SourceSlice slice = ast_ident_slice(d->m_ast, id);
+        entry.name = QString::fromUtf8(slice.data, slice.len);
+        entry.string = KDevelop::IndexedString(entry.name);
+        entry.identifier = KDevelop::IndexedIdentifier(KDevelop::Identifier(entry.string));
+    }
+    return entry;
+}
+
+void ParseSession::reparse(const ParseSessionData::Ptr &previous)
 {
     clearUnresolvedImports();
-    d->parse();
+    if (previous) {
+        d->reparse(*previous);
+    } else {
+        d->parse(ParseMode_Full);
+    }
 }
 
 ParseSessionData::Ptr ParseSession::data() const
@@ -117,37 +309,119 @@ KDevelop::IProject* ParseSession::project() const
 void ParseSession::setContextOnNode(const ZigNode &node, KDevelop::DUContext *context)
 {
     Q_ASSERT(node.ast == d->m_ast);
-    d->m_nodeContextMap.insert(node.index, context);
+    d->m_nodeContexts.insert(node.index, context);
 }
 
 KDevelop::DUContext *ParseSession::contextFromNode(const ZigNode &node)
 {
     Q_ASSERT(node.ast == d->m_ast);
-    return d->m_nodeContextMap.value(node.index);
+    return d->m_nodeContexts.value(node.index);
 }
 
 void ParseSession::setTypeOnNode(const ZigNode &node, const KDevelop::AbstractType::Ptr &type)
 {
     Q_ASSERT(node.ast == d->m_ast);
-    d->m_nodeTypeMap.insert(node.index, type);
+    d->m_nodeTypes.insert(node.index, type);
 }
 
 KDevelop::AbstractType::Ptr ParseSession::typeFromNode(const ZigNode &node)
 {
     Q_ASSERT(node.ast == d->m_ast);
-    return d->m_nodeTypeMap.value(node.index);
+    return d->m_nodeTypes.value(node.index);
 }
 
 void ParseSession::setDeclOnNode(const ZigNode &node, const KDevelop::DeclarationPointer &decl)
 {
     Q_ASSERT(node.ast == d->m_ast);
-    d->m_nodeDeclMap.insert(node.index, decl);
+    d->m_nodeDecls.insert(node.index, decl);
 }
 
 KDevelop::DeclarationPointer ParseSession::declFromNode(const ZigNode &node)
 {
     Q_ASSERT(node.ast == d->m_ast);
-    return d->m_nodeDeclMap.value(node.index);
+    return d->m_nodeDecls.value(node.index);
+}
+
+bool ParseSession::cachedExpression(const ZigNode &node, const KDevelop::DUContext *context, CachedExpression &result)
+{
+    // Nodes of other documents are never cached
+    if (node.ast != d->m_ast) {
+        return false;
+    }
+    result = d->m_expressions.value(node.index);
+    if (result.type && result.context == context) {
+        d->m_expressionStats.hits++;
+        return true;
+    }
+    d->m_expressionStats.misses++;
+    return false;
+}
+
+void ParseSession::setCachedExpression(const ZigNode &node, const KDevelop::DUContext *context,
+                                       const KDevelop::AbstractType::Ptr &type,
+                                       const KDevelop::DeclarationPointer &decl)
+{
+    if (node.ast != d->m_ast || !type) {
+        return;
+    }
+    d->m_expressions.insert(node.index, CachedExpression{context, type, decl});
+}
+
+void ParseSession::invalidateExpressionCache()
+{
+    const uint32_t nodeCount = d->m_ast ? ast_view(d->m_ast)->node_count : 0;
+    d->m_expressions.reset(nodeCount);
+}
+
+ExpressionCacheStats ParseSession::expressionCacheStats() const
+{
+    return d->m_expressionStats;
+}
+
+bool ParseSession::isUnchangedBody(const ZigNode &node) const
+{
+    return node.ast == d->m_ast && d->m_unchangedBodies.contains(node.index);
+}
+
+bool ParseSession::hasUnchangedBodies() const
+{
+    return !d->m_unchangedBodies.isEmpty();
+}
+
+QList<KDevelop::ProblemPointer> ParseSession::unchangedBodyProblems(const KDevelop::TopDUContext *top) const
+{
+    QList<KDevelop::ProblemPointer> kept;
+    if (!top || d->m_unchangedBodies.isEmpty()) {
+        return kept;
+    }
+    QVector<KTextEditor::Range> ranges;
+    ranges.reserve(d->m_unchangedBodies.size());
+    for (const NodeIndex body : d->m_unchangedBodies) {
+        ranges.append(ZigNode{d->m_ast, body}.range().castToSimpleRange());
+    }
+    const auto problems = top->problems();
+    for (const auto &problem : problems) {
+        if (problem->source() != KDevelop::IProblem::SemanticAnalysis) {
+            continue;
+        }
+        const auto start = problem->finalLocation().start();
+        for (const auto &range : ranges) {
+            if (range.contains(start)) {
+                kept.append(problem);
+                break;
+            }
+        }
+    }
+    return kept;
+}
+
+void ParseSession::releaseBuildState()
+{
+    d->m_nodeContexts.reset(0);
+    d->m_nodeTypes.reset(0);
+    d->m_nodeDecls.reset(0);
+    d->m_expressions.reset(0);
+    d->m_job = nullptr;
 }
 
 void ParseSession::addUnresolvedImport(const KDevelop::IndexedString &module)
@@ -20,9 +20,12 @@
 
 #include <QSet>
 #include <QMap>
+#include <QVector>
 
 #include <interfaces/iproject.h>
 #include <language/duchain/ducontext.h>
+#include <language/duchain/identifier.h>
+#include <language/duchain/problem.h>
 #include <language/interfaces/iastcontainer.h>
 #include <language/backgroundparser/parsejob.h>
 #include <serialization/indexedstring.h>
@@ -34,6 +37,77 @@
 namespace Zig
 {
 
+// Conversions of an interned identifier, done once per document
+struct KDEVZIGDUCHAIN_EXPORT CachedIdentifier
+{
+    QString name;
+    KDevelop::IndexedString string;
+    KDevelop::IndexedIdentifier identifier;
+    inline bool isValid() const { return !name.isEmpty(); }
+};
+
+// Values stored per node of an ast. A lookup is an index into a flat array
+// and reset is O(1) by bumping the generation stored values must match.
+// Stale values are released when overwritten or when the node count changes.
+template <typename T>
+class NodeTable
+{
+public:
+    void reset(uint32_t nodeCount)
+    {
+        if (nodeCount != m_nodeCount) {
+            m_values.clear();
+            m_generations.clear();
+            m_nodeCount = nodeCount;
+        }
+        if (++m_generation == 0) {
+            m_generations.fill(0);
+            m_generation = 1;
+        }
+    }
+
+    void insert(uint32_t index, const T &value)
+    {
+        Q_ASSERT(index < m_nodeCount);
+        // Only allocated once something is stored
+        if (m_generations.isEmpty()) {
+            m_values.resize(m_nodeCount);
+            m_generations.resize(m_nodeCount);
+        }
+        m_values[index] = value;
+        m_generations[index] = m_generation;
+    }
+
+    T value(uint32_t index) const
+    {
+        if (index < static_cast<uint32_t>(m_generations.size()) && m_generations[index] == m_generation) {
+            return m_values[index];
+        }
+        return T();
+    }
+
+private:
+    QVector<T> m_values;
+    QVector<uint32_t> m_generations;
+    uint32_t m_nodeCount = 0;
+    uint32_t m_generation = 1;
+};
+
+// Result of an ExpressionVisitor for a node, only valid in the context
+// it was evaluated in
+struct KDEVZIGDUCHAIN_EXPORT CachedExpression
+{
+    const KDevelop::DUContext *context = nullptr;
+    KDevelop::AbstractType::Ptr type;
+    KDevelop::DeclarationPointer decl;
+};
+
+struct KDEVZIGDUCHAIN_EXPORT ExpressionCacheStats
+{
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+};
+
 class KDEVZIGDUCHAIN_EXPORT ParseSessionData : public KDevelop::IAstContainer
 {
 public:
@@ -48,22 +122,38 @@ public:
 
     ZAst *ast() const { return m_ast; }
     const QByteArray& source() const { return m_contents; }
+    // Use the on-disk ast cache, only for documents that are not open
+    void setAstCacheEnabled(bool enabled) { m_astCacheEnabled = enabled; }
 
 private:
     friend class ParseSession;
 
-    void parse();
+    void parse(ParseMode mode = ParseMode_Full);
+    // Parse the contents as an edit of the previous contents of the
+    // document, see ParseSession::isUnchangedBody
+    void reparse(const ParseSessionData &previous);
+    // Path of the on-disk ast cache for the contents or empty if not cached.
+    // The key of the contents is set if it is.
+    QString astCachePath(ParseMode mode, uint64_t &key) const;
+    // Node indexes refer to the current ast
+    void resetNodeTables();
 
     KDevelop::IndexedString m_document;
     QByteArray m_contents;
     ZAst *m_ast;
     int m_jobPriority;
-    QMap<uint32_t, KDevelop::DUContext *> m_nodeContextMap;
-    QMap<uint32_t, KDevelop::AbstractType::Ptr> m_nodeTypeMap;
-    QMap<uint32_t, KDevelop::DeclarationPointer> m_nodeDeclMap;
+    NodeTable<KDevelop::DUContext *> m_nodeContexts;
+    NodeTable<KDevelop::AbstractType::Ptr> m_nodeTypes;
+    NodeTable<KDevelop::DeclarationPointer> m_nodeDecls;
+    NodeTable<CachedExpression> m_expressions;
+    ExpressionCacheStats m_expressionStats;
     QSet<KDevelop::IndexedString> m_unresolvedImports;
+    QSet<NodeIndex> m_unchangedBodies;
+    // Indexed by ast_token_ident_id, filled on first use
+    QVector<CachedIdentifier> m_identifiers;
     const KDevelop::ParseJob* m_job;
     KDevelop::IProject* m_project;
+    bool m_astCacheEnabled;
 };
 
 class KDEVZIGDUCHAIN_EXPORT ParseSession
@@ -74,7 +164,11 @@ public:
 
     static KDevelop::IndexedString languageString();
 
-    void parse();
+    // A skeleton parse only has the declarations, see ParseMode
+    void parse(ParseMode mode = ParseMode_Full);
+    // Full parse of the contents as an edit of the previous session of the
+    // document so the bodies the edit did not touch are known
+    void reparse(const ParseSessionData::Ptr &previous);
 
     ParseSessionData::Ptr data() const;
     void setData(const ParseSessionData::Ptr data);
@@ -94,6 +188,32 @@ public:
     void setDeclOnNode(const ZigNode &node, const KDevelop::DeclarationPointer &decl);
     KDevelop::DeclarationPointer declFromNode(const ZigNode &node);
 
+    // Memoized expression results keyed on (node, context). Types of
+    // declarations change between builder passes so every pass starts
+    // by invalidating them.
+    bool cachedExpression(const ZigNode &node, const KDevelop::DUContext *context, CachedExpression &result);
+    void setCachedExpression(const ZigNode &node, const KDevelop::DUContext *context,
+                             const KDevelop::AbstractType::Ptr &type,
+                             const KDevelop::DeclarationPointer &decl);
+    void invalidateExpressionCache();
+    // Lookups since the last parse
+    ExpressionCacheStats expressionCacheStats() const;
+
+    // Converted name of an identifier token, invalid if it is not one
+    const CachedIdentifier &identifier(const ZigNode &node, TokenIndex token);
+
+    // The node is the body of a root fn or test that the reparse did not
+    // touch while nothing outside of the bodies changed. The contexts, uses
+    // and problems of the previous build in it are still valid.
+    bool isUnchangedBody(const ZigNode &node) const;
+    bool hasUnchangedBodies() const;
+    // Problems of the previous build found by the use builder in the
+    // unchanged bodies, it does not visit them again
+    QList<KDevelop::ProblemPointer> unchangedBodyProblems(const KDevelop::TopDUContext *top) const;
+    // Release everything stored per node and the job so only the ast and
+    // contents are kept for the next reparse, see ParseJob
+    void releaseBuildState();
+
     void addUnresolvedImport(const KDevelop::IndexedString& module);
     void clearUnresolvedImports();
     QSet<KDevelop::IndexedString> unresolvedImports() const;
@@ -18,12 +18,15 @@
 #include "duchaintest.h"
 
 #include <QtTest/QtTest>
+#include <QProcess>
+#include <QTemporaryDir>
 
 #include <language/backgroundparser/backgroundparser.h>
 #include <language/codegen/coderepresentation.h>
 #include <language/duchain/ducontext.h>
 #include <language/duchain/duchainutils.h>
 #include <language/duchain/topducontext.h>
+#include <language/duchain/use.h>
 
 #include <tests/testcore.h>
 #include <tests/testfile.h>
@@ -32,10 +35,12 @@
 #include <tests/testlanguagecontroller.h>
 
 #include "types/builtintype.h"
+#include "types/delayedtype.h"
 #include "parsesession.h"
 #include "declarationbuilder.h"
 #include "usebuilder.h"
 #include "helpers.h"
+#include "importscheduler.h"
 
 using namespace KDevelop;
 
@@ -121,6 +126,18 @@ ReferencedTopDUContext parseStdCode(const QString &path)
     return parseFile(filename);
 }
 
+// Only parses, the data keeps the source and ast of the std file alive
+ParseSessionData::Ptr parseStdFile(const QString &path)
+{
+    QFile f(QStringLiteral("%1/%2").arg(Zig::Helper::stdLibPath(nullptr), path));
+    if (!f.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    ParseSessionData::Ptr data(new ParseSessionData(IndexedString(f.fileName()), f.readAll(), nullptr));
+    ParseSession(data).parse();
+    return data->ast() ? data : ParseSessionData::Ptr();
+}
+
 
 DUContext *getInternalContext(ReferencedTopDUContext topContext, QString name, bool firstChildContext=false)
 {
@@ -183,8 +200,21 @@ void DUChainTest::initTestCase()
 void DUChainTest::sanityTagName()
 {
     // Make sure Ast tags are in sync
-    QVERIFY(ast_tag_by_name("call") == NodeTag_call);
-    QVERIFY(ast_tag_by_name("error_union") == NodeTag_error_union);
+    QVERIFY(ast_tag_by_name("call", 4) == NodeTag_call);
+    QVERIFY(ast_tag_by_name("error_union", 11) == NodeTag_error_union);
+}
+
+void DUChainTest::sanityCheckSourceNotCopied()
+{
+    // The session and the ast must share the document contents
+    const QByteArray contents = QByteArrayLiteral("const x = 1;\n");
+    IndexedString document(QLatin1String("/tmp/copy.zig"));
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData(document, contents, nullptr)));
+    session.parse();
+    QVERIFY(session.ast());
+    QVERIFY(session.data()->source().constData() == contents.constData());
+    QVERIFY(ast_source(session.ast()).data == contents.constData());
+    QCOMPARE(ast_source(session.ast()).len, static_cast<uint32_t>(contents.size()));
 }
 
 void DUChainTest::sanityCheckFn()
@@ -256,6 +286,326 @@ void DUChainTest::sanityCheckTypeInfo()
     QCOMPARE(decls.first()->abstractType()->toString(), QLatin1String("std.builtin.Type::Int"));
 }
 
+void DUChainTest::testExpressionCache()
+{
+    // The field access lhs is evaluated by the use builder and again
+    // when it visits the identifier
+    QString code(QStringLiteral(
+        "const S = struct { x: u8 };\n"
+        "const s = S{.x = 1};\n"
+        "const y = s.x;\n"
+        "const z = s.x + y;\n"));
+    IndexedString document(QStringLiteral("/tmp/expression_cache.zig"));
+    ParseSession session(ParseSessionData::Ptr(nullptr));
+    session.setData(ParseSessionData::Ptr(new ParseSessionData(document, code.toUtf8(), nullptr)));
+    session.parse();
+    QVERIFY(session.ast());
+
+    ZigNode root = {session.ast(), 0};
+    DeclarationBuilder declarationBuilder;
+    declarationBuilder.setParseSession(&session);
+    ReferencedTopDUContext context = declarationBuilder.build(document, &root);
+    UseBuilder useBuilder(document);
+    useBuilder.setParseSession(&session);
+    useBuilder.buildUses(&root);
+    QVERIFY(context.data());
+
+    const auto stats = session.expressionCacheStats();
+    qDebug() << "expression cache hits" << stats.hits << "misses" << stats.misses;
+    QVERIFY(stats.hits > 0);
+    QVERIFY(stats.misses > 0);
+
+    {
+        DUChainReadLocker lock;
+        auto decls = context->findDeclarations(Identifier(QLatin1String("y")));
+        QCOMPARE(decls.size(), 1);
+        QCOMPARE(decls.first()->abstractType()->toString(), QLatin1String("u8"));
+    }
+
+    // Nothing survives an invalidation
+    CachedExpression cached;
+    session.invalidateExpressionCache();
+    for (uint32_t i = 0; i < ast_view(session.ast())->node_count; i++) {
+        QVERIFY(!session.cachedExpression(ZigNode{session.ast(), i}, context.data(), cached));
+    }
+
+    // Or a new parse
+    session.parse();
+    QCOMPARE(session.expressionCacheStats().hits, 0u);
+    QCOMPARE(session.expressionCacheStats().misses, 0u);
+}
+
+// Uses in a context and its children as "line,column name"
+static QStringList useNames(const DUContext *context)
+{
+    QStringList names;
+    if (!context) {
+        return names;
+    }
+    for (int i = 0; i < context->usesCount(); i++) {
+        const Use &use = context->uses()[i];
+        const Declaration *decl = use.usedDeclaration(context->topContext());
+        names.append(QStringLiteral("%1,%2 %3").arg(use.m_range.start.line).arg(use.m_range.start.column)
+            .arg(decl ? decl->identifier().toString() : QStringLiteral("?")));
+    }
+    for (const DUContext *child : context->childContexts()) {
+        names.append(useNames(child));
+    }
+    return names;
+}
+
+void DUChainTest::testReparse()
+{
+    // Only the body of b changes so the uses and problems in the body
+    // of a are kept from the first build
+    const QByteArray before(
+        "const Status = enum{Ok, Error};\n"
+        "fn a() void {\n"
+        "    var x: Status = .Missing;\n"
+        "    x = .Ok;\n"
+        "}\n"
+        "fn b() u8 {\n"
+        "    return 1;\n"
+        "}\n");
+    QByteArray after(before);
+    after.replace("return 1;", "return 2;");
+    IndexedString document(QStringLiteral("/tmp/reparse.zig"));
+
+    ParseSessionData::Ptr previous(new ParseSessionData(document, before, nullptr));
+    ReferencedTopDUContext context;
+    {
+        ParseSession session(previous);
+        session.parse();
+        QVERIFY(session.ast());
+        ZigNode root = {session.ast(), 0};
+        DeclarationBuilder declarationBuilder;
+        declarationBuilder.setParseSession(&session);
+        context = declarationBuilder.build(document, &root);
+        UseBuilder useBuilder(document);
+        useBuilder.setParseSession(&session);
+        useBuilder.buildUses(&root);
+        QVERIFY(!session.hasUnchangedBodies());
+        session.releaseBuildState();
+    }
+    QVERIFY(context.data());
+
+    // Same steps as the parse job
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData(document, after, nullptr)));
+    session.reparse(previous);
+    QVERIFY(session.ast());
+    ZigNode root = {session.ast(), 0};
+    const NodeSpan decls = root.children();
+    QCOMPARE(decls.len, 3u);
+    QVERIFY(session.isUnchangedBody(ZigNode{session.ast(), decls.data[1]}.rhsAsNode()));
+    QVERIFY(!session.isUnchangedBody(ZigNode{session.ast(), decls.data[2]}.rhsAsNode()));
+
+    QList<ProblemPointer> keptProblems;
+    {
+        DUChainWriteLocker lock;
+        keptProblems = session.unchangedBodyProblems(context.data());
+        context->clearProblems();
+    }
+    QCOMPARE(keptProblems.size(), 1);
+    DeclarationBuilder declarationBuilder;
+    declarationBuilder.setParseSession(&session);
+    context = declarationBuilder.build(document, &root, context);
+    {
+        DUChainWriteLocker lock;
+        for (const auto &problem : std::as_const(keptProblems)) {
+            context->addProblem(problem);
+        }
+    }
+    UseBuilder useBuilder(document);
+    useBuilder.setParseSession(&session);
+    useBuilder.buildUses(&root);
+
+    // Matches a build from scratch
+    ReferencedTopDUContext full = parseCode(QString::fromUtf8(after), QStringLiteral("/tmp/reparse_full.zig"));
+    QVERIFY(full.data());
+    DUChainReadLocker lock;
+    QCOMPARE(context->problems().size(), full->problems().size());
+    QVERIFY(context->problems().first()->description().contains(QLatin1String("Missing")));
+    const CursorInRevision inA(3, 4);
+    const QStringList uses = useNames(context->findContextAt(inA));
+    QVERIFY(uses.contains(QLatin1String("2,11 Status")));
+    QCOMPARE(uses, useNames(full->findContextAt(inA)));
+    const CursorInRevision inB(6, 4);
+    QCOMPARE(useNames(context->findContextAt(inB)), useNames(full->findContextAt(inB)));
+}
+
+bool DUChainTest::writeFiles(const QTemporaryDir &dir, const QMap<QString, QByteArray> &files)
+{
+    if (!dir.isValid()) {
+        return false;
+    }
+    for (auto it = files.constBegin(); it != files.constEnd(); ++it) {
+        QFile f(dir.filePath(it.key()));
+        if (!f.open(QIODevice::WriteOnly) || f.write(it.value()) != it.value().size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DUChainTest::testImportOrder()
+{
+    // a imports b and c, which import each other, and b imports d
+    QTemporaryDir dir;
+    const QMap<QString, QByteArray> files = {
+        {QStringLiteral("a.zig"), "const b = @import(\"b.zig\");\nconst c = @import(\"c.zig\");\n"},
+        {QStringLiteral("b.zig"), "const c = @import(\"c.zig\");\nconst d = @import(\"d.zig\");\n"},
+        {QStringLiteral("c.zig"), "pub const b = @import(\"b.zig\").d;\n"},
+        {QStringLiteral("d.zig"), "const x = 1;\n// @import(\"a.zig\")\n"},
+    };
+    QVERIFY(writeFiles(dir, files));
+    auto url = [&](const QString &name) {
+        return IndexedString(QUrl::fromLocalFile(dir.filePath(name)));
+    };
+
+    ImportScheduler scheduler;
+    scheduler.setMode(ImportScheduler::EagerImports);
+    const auto a = url(QStringLiteral("a.zig"));
+    const auto imports = ImportScheduler::scanImports(a, files.value(QStringLiteral("a.zig")));
+    QCOMPARE(imports.size(), 2);
+    QCOMPARE(imports.at(0), url(QStringLiteral("b.zig")));
+
+    auto order = scheduler.order(a, files.value(QStringLiteral("a.zig")), [](const IndexedString &) {
+        return false;
+    });
+    QCOMPARE(order.files.size(), 4);
+    QCOMPARE(order.files.last(), a);
+    auto levelOf = [&](const QString &name) {
+        return order.levels.at(order.files.indexOf(url(name)));
+    };
+    auto componentOf = [&](const QString &name) {
+        return order.components.at(order.files.indexOf(url(name)));
+    };
+    QCOMPARE(order.files.first(), url(QStringLiteral("d.zig")));
+    QCOMPARE(levelOf(QStringLiteral("d.zig")), 0);
+    QCOMPARE(levelOf(QStringLiteral("b.zig")), 1);
+    QCOMPARE(levelOf(QStringLiteral("c.zig")), 1);
+    QCOMPARE(levelOf(QStringLiteral("a.zig")), 2);
+    QCOMPARE(componentOf(QStringLiteral("b.zig")), componentOf(QStringLiteral("c.zig")));
+    QVERIFY(componentOf(QStringLiteral("b.zig")) != componentOf(QStringLiteral("d.zig")));
+
+    // The cycle is parsed again at most once for the other file
+    const QSet<IndexedString> unresolved = {url(QStringLiteral("c.zig"))};
+    QVERIFY(scheduler.shouldReparse(url(QStringLiteral("b.zig")), unresolved));
+    QVERIFY(!scheduler.shouldReparse(url(QStringLiteral("b.zig")), unresolved));
+    QVERIFY(!scheduler.shouldReparse(a, {url(QStringLiteral("b.zig"))}));
+
+    // Parsed files are not visited again
+    order = scheduler.order(a, files.value(QStringLiteral("a.zig")), [&](const IndexedString &file) {
+        return file != url(QStringLiteral("c.zig"));
+    });
+    QCOMPARE(order.files.size(), 2);
+    QCOMPARE(order.files.first(), url(QStringLiteral("c.zig")));
+    QCOMPARE(order.levels.last(), 1);
+
+    // Lazily only the document's own imports are parsed first
+    scheduler.setMode(ImportScheduler::LazyImports);
+    order = scheduler.order(a, files.value(QStringLiteral("a.zig")), [](const IndexedString &) {
+        return false;
+    });
+    QCOMPARE(order.files.size(), 3);
+    QVERIFY(!order.files.contains(url(QStringLiteral("d.zig"))));
+    QCOMPARE(levelOf(QStringLiteral("b.zig")), 0);
+    QCOMPARE(levelOf(QStringLiteral("c.zig")), 0);
+    QCOMPARE(order.levels.last(), 1);
+    qDebug() << "scanned" << scheduler.stats().scanned;
+}
+
+void DUChainTest::testLazyImport()
+{
+    // m is parsed before n so its import of n stays delayed
+    QTemporaryDir dir;
+    const QMap<QString, QByteArray> files = {
+        {QStringLiteral("m.zig"), "pub const n = @import(\"n.zig\");\n"},
+        {QStringLiteral("n.zig"), "pub const x = 5;\n"},
+    };
+    QVERIFY(writeFiles(dir, files));
+    const IndexedString n(QUrl::fromLocalFile(dir.filePath(QStringLiteral("n.zig"))));
+    const QString mainFile = dir.filePath(QStringLiteral("main.zig"));
+    const QString code = QStringLiteral("const m = @import(\"m.zig\");\nconst y = m.n.x;\n");
+
+    ImportScheduler &scheduler = ImportScheduler::self();
+    const auto mode = scheduler.mode();
+    scheduler.setMode(ImportScheduler::LazyImports);
+    const auto demanded = scheduler.stats().demanded;
+
+    // Nothing accesses n yet so it is not scheduled
+    ReferencedTopDUContext mod_m = parseFile(dir.filePath(QStringLiteral("m.zig")));
+    QVERIFY(mod_m.data());
+    QVERIFY(!ICore::self()->languageController()->backgroundParser()->isQueued(n));
+    QCOMPARE(scheduler.stats().demanded, demanded);
+
+    // Accessing x through it requests n once
+    ReferencedTopDUContext context = parseCode(code, mainFile);
+    QVERIFY(context.data());
+    QCOMPARE(scheduler.stats().demanded, demanded + 1);
+    QVERIFY(scheduler.takeDemanded(IndexedString(mainFile)));
+    QVERIFY(!scheduler.takeDemanded(IndexedString(mainFile)));
+    {
+        DUChainReadLocker lock;
+        auto decls = context->findDeclarations(Identifier(QLatin1String("y")));
+        QCOMPARE(decls.size(), 1);
+        // Unknown until n is parsed
+        QCOMPARE(decls.first()->abstractType()->toString(), QLatin1String("mixed"));
+    }
+
+    // Once n is parsed the delayed import in m resolves without parsing m again
+    ReferencedTopDUContext mod_n = parseFile(dir.filePath(QStringLiteral("n.zig")));
+    QVERIFY(mod_n.data());
+    context = parseCode(code, mainFile);
+    QVERIFY(context.data());
+    QCOMPARE(scheduler.stats().demanded, demanded + 1);
+    scheduler.setMode(mode);
+
+    DUChainReadLocker lock;
+    auto decls = mod_m->findDeclarations(Identifier(QLatin1String("n")));
+    QCOMPARE(decls.size(), 1);
+    QVERIFY(decls.first()->abstractType().dynamicCast<Zig::DelayedType>());
+    decls = context->findDeclarations(Identifier(QLatin1String("y")));
+    QCOMPARE(decls.size(), 1);
+    QCOMPARE(decls.first()->abstractType()->toString(), QLatin1String("comptime_int = 5"));
+}
+
+void DUChainTest::testLazyImportJob()
+{
+    // A file parsed by the background parser because it is imported does
+    // not queue its own imports
+    QTemporaryDir dir;
+    const QMap<QString, QByteArray> files = {
+        {QStringLiteral("m.zig"), "pub const n = @import(\"n.zig\");\npub const k = 1;\n"},
+        {QStringLiteral("n.zig"), "pub const o = @import(\"o.zig\");\n"},
+        {QStringLiteral("o.zig"), "pub const x = 5;\n"},
+    };
+    QVERIFY(writeFiles(dir, files));
+    auto url = [&](const QString &name) {
+        return IndexedString(QUrl::fromLocalFile(dir.filePath(name)));
+    };
+    const auto m = url(QStringLiteral("m.zig"));
+    const auto n = url(QStringLiteral("n.zig"));
+    const auto o = url(QStringLiteral("o.zig"));
+
+    ImportScheduler &scheduler = ImportScheduler::self();
+    const auto mode = scheduler.mode();
+    scheduler.setMode(ImportScheduler::LazyImports);
+    auto *bgparser = ICore::self()->languageController()->backgroundParser();
+    auto isParsed = [](const IndexedString &file) {
+        DUChainReadLocker lock;
+        return DUChain::self()->chainForDocument(file) != nullptr;
+    };
+
+    Helper::scheduleDependency(m, BackgroundParser::NormalPriority);
+    bgparser->parseDocuments();
+    QTRY_VERIFY_WITH_TIMEOUT(isParsed(m) && !bgparser->isQueued(m), 10000);
+    QVERIFY(!bgparser->isQueued(n));
+    QVERIFY(!isParsed(n));
+    QVERIFY(!bgparser->isQueued(o));
+    scheduler.setMode(mode);
+}
+
 void DUChainTest::sanityCheckBasicImport()
 {
     ReferencedTopDUContext mod_a = parseFile(assetsDir.filePath(QLatin1String("basic_import/a.zig")));
@@ -590,6 +940,19 @@ void DUChainTest::testVarType_data()
     QTest::newRow("extern fn ptr") << "extern fn foo_add(a: u8, b: u8) u8; const add = foo_add;" << "add" << "function u8 (u8, u8)"<< "";
     //QTest::newRow("struct field fn ptr") << "const Math = struct { add: fn(a: u8, b: u8) u8}; test { const m = Math{}; const y = m.add(1, 2);\n" << "y" << "u8"<< "1, 0";
     QTest::newRow("fn err!void") << "const WriteError = error{EndOfStream};\npub fn main() WriteError!void {}" << "main" << "function WriteError!void ()"<< "";
+    QTest::newRow("out of order value") << "const a = b; const b = true;" << "a" << "bool = true" << "";
+    QTest::newRow("out of order chain") << "const a = b; const b = c; const c = true;" << "a" << "bool = true" << "";
+    QTest::newRow("out of order field") << "const A = struct {\n b: B\n}; const B = struct {};" << "b" << "B" << "A";
+    QTest::newRow("out of order fn arg") << "pub fn main(a: Foo) void {} const Foo = struct {};" << "main" << "function void (Foo)" << "";
+    QTest::newRow("out of order fn return") << "pub fn main() Foo {} const Foo = struct {};" << "main" << "function Foo ()" << "";
+    // Captures of something declared further down are deferred
+    QTest::newRow("out of order if capture") << "test { if (a) |y| {\n} } const a: ?u8 = 0;" << "y" << "u8" << "1,0";
+    QTest::newRow("out of order while capture") << "test { while (a) |y| {\n} } const a: ?u8 = 0;" << "y" << "u8" << "1,0";
+    QTest::newRow("out of order catch capture") << "test { write() catch |err| {\n}; } pub fn write() WriteError!void {} const WriteError = error{EndOfStream};" << "err" << "WriteError" << "1,0";
+    QTest::newRow("out of order for capture") << "test { for (a) |y| {\n} } const a: [2]i8 = undefined;" << "y" << "i8" << "1,0";
+    // An unresolved usingnamespace can hide anything after it so the
+    // declarations are built a second time
+    QTest::newRow("out of order usingnamespace") << "usingnamespace A; const x = a;\nconst A = struct { pub const a = 1; };" << "x" << "comptime_int = 1" << "";
     QTest::newRow("var struct") << "const Foo = struct {a: u8};\ntest {\nvar f = Foo{};}" << "f" << "Foo" << "2,0";
     QTest::newRow("field access") << "const Foo = struct {a: u8=0};\ntest {\nvar f = Foo{}; var b = f.a;\n}" << "b" << "u8" << "3,0";
     QTest::newRow("field ptr") << "const Foo = struct {a: u8=0};\ntest {\nvar f = &Foo{}; var b = f.a;\n}" << "b" << "u8" << "3,0";
@@ -692,6 +1055,8 @@ void DUChainTest::testVarType_data()
 
     // Builtin calls
     QTest::newRow("@This()") << "const Foo = struct { const Self = @This();\n};" << "Self" << "Foo" << "1,0";
+    QTest::newRow("@This() in fn") << "const Foo = struct { fn foo() void { const Self = @This(); _ = Self;\n } };" << "Self" << "Foo" << "1,0";
+    QTest::newRow("@This() nested") << "const Foo = struct { const Bar = struct { const Self = @This();\n }; };" << "Self" << "Foo::Bar" << "1,0";
     QTest::newRow("@sizeOf()") << "const Foo = struct { a: u8, }; test {var x = @sizeOf(Foo);\n}" << "x" << "comptime_int" << "1,0";
     QTest::newRow("@as()") << "test{var x = @as(u8, 1);\n}" << "x" << "u8 = 1" << "1,0";
     QTest::newRow("@as(u32) << 2") << "test{var x = @as(u32, 0xFF) << 8;\n}" << "x" << "u32 = 0xff00" << "1,0";
@@ -707,11 +1072,9 @@ void DUChainTest::testVarType_data()
     QTest::newRow("@cImport usingnamespace") << "usingnamespace @cImport({@cInclude(\"/usr/include/locale.h\")}); const f = setlocale;" << "f" << "function char* (int, const char*)" << "";
 
 
-    QTest::newRow("cast @boolFromInt()") << "const y: u8 = 7; const x = @boolFromInt(y);" << "x" << "bool = true" << "";
     // TODO: Comptime known
     QTest::newRow("cast @intCast()") << "const y: i8 = 7; const x: u8 = @intCast(y);" << "x" << "u8" << "";
     QTest::newRow("cast @ptrCast()") << "const y: *i8 = undefined; const x: *u8 = @ptrCast(y);" << "x" << "*u8" << "";
-    QTest::newRow("cast @boolFromInt() 2") << "const y: i8 = 1; const x = @boolFromInt(-y);" << "x" << "bool = true" << "";
     QTest::newRow("cast @intFromBool()") << "const x: u8 = @intFromBool(true);" << "x" << "u8 = 1" << "";
     QTest::newRow("cast @intFromBool() 2") << "const x: i8 = @intFromBool(false);" << "x" << "i8 = 0" << "";
     QTest::newRow("@fieldParentPtr()") <<
@@ -993,4 +1356,253 @@ void DUChainTest::testProblems_data()
     QTest::newRow("vector splat") << "test { var x: @Vector(4, f32) = undefined; x = @splat(1); }" << QStringList{} << "";
 }
 
+void DUChainTest::benchmarkParseLineCount()
+{
+    // Time per line should stay roughly constant as the file grows
+    QFETCH(int, lines);
+    QString code;
+    for (int i = 0; i < lines; i += 6) {
+        code += QStringLiteral(
+            "/// Register %1\n"
+            "pub const REG%1 = struct {\n"
+            "    value: u32 = %1,\n"
+            "    pub fn read(self: REG%1) u32 { return self.value; }\n"
+            "};\n"
+            "\n").arg(i);
+    }
+    QBENCHMARK {
+        ReferencedTopDUContext context = parseCode(code, QLatin1String("/tmp/bench.zig"));
+        QVERIFY(context.data());
+    }
+}
+
+void DUChainTest::benchmarkParseLineCount_data()
+{
+    QTest::addColumn<int>("lines");
+    QTest::newRow("1000 lines") << 1000;
+    QTest::newRow("5000 lines") << 5000;
+    QTest::newRow("10000 lines") << 10000;
+    QTest::newRow("20000 lines") << 20000;
+}
+
+void DUChainTest::benchmarkNodeAccess()
+{
+    // Compare the ffi accessors with reading the ast view directly
+    QFETCH(QString, path);
+    QFETCH(bool, direct);
+    const ParseSessionData::Ptr data = parseStdFile(path);
+    QVERIFY(data);
+    ZAst *tree = data->ast();
+    const uint32_t n = ast_view(tree)->node_count;
+    uint64_t total = 0;
+    QBENCHMARK {
+        for (uint32_t i = 0; i < n; i++) {
+            if (direct) {
+                ZigNode node = {tree, i};
+                total += node.tag() + node.data().lhs + node.mainTokenIndex();
+            } else {
+                total += ast_node_tag(tree, i)
+                    + ast_node_data(tree, i).lhs
+                    + ast_node_main_token(tree, i);
+            }
+        }
+    }
+    QVERIFY(total > 0);
+}
+
+void DUChainTest::benchmarkNodeAccess_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<bool>("direct");
+    QTest::newRow("ffi zig/Ast.zig") << "zig/Ast.zig" << false;
+    QTest::newRow("view zig/Ast.zig") << "zig/Ast.zig" << true;
+    QTest::newRow("ffi os/linux.zig") << "os/linux.zig" << false;
+    QTest::newRow("view os/linux.zig") << "os/linux.zig" << true;
+}
+
+void DUChainTest::benchmarkFormat()
+{
+    // Compare zig fmt in a subprocess with formatting in-process either
+    // from source or by rendering the already parsed ast
+    QFETCH(QString, path);
+    QFETCH(QString, mode);
+    const ParseSessionData::Ptr data = parseStdFile(path);
+    QVERIFY(data);
+    ZAst *tree = data->ast();
+    const QByteArray &source = data->source();
+    const QByteArray expected = Zig::Helper::formatSource(source);
+    QVERIFY(!expected.isNull());
+    QCOMPARE(Zig::Helper::formatSource(source, tree), expected);
+
+    const QString zigExe = Zig::Helper::zigExecutablePath(nullptr);
+    if (mode == QLatin1String("process") && !QFile::exists(zigExe)) {
+        QSKIP("zig executable not found");
+    }
+    QByteArray formatted;
+    QBENCHMARK {
+        if (mode == QLatin1String("process")) {
+            QProcess zig;
+            zig.start(zigExe, QStringList{QStringLiteral("fmt"), QStringLiteral("--stdin")});
+            zig.write(source);
+            zig.closeWriteChannel();
+            QVERIFY(zig.waitForFinished());
+            formatted = zig.readAllStandardOutput();
+        } else if (mode == QLatin1String("render")) {
+            formatted = Zig::Helper::formatSource(source, tree);
+        } else {
+            formatted = Zig::Helper::formatSource(source);
+        }
+    }
+    QCOMPARE(formatted, expected);
+}
+
+void DUChainTest::benchmarkFormat_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<QString>("mode");
+    QTest::newRow("process zig/Ast.zig") << "zig/Ast.zig" << "process";
+    QTest::newRow("format zig/Ast.zig") << "zig/Ast.zig" << "format";
+    QTest::newRow("render zig/Ast.zig") << "zig/Ast.zig" << "render";
+}
+
+void DUChainTest::benchmarkAstCache()
+{
+    // Cold start time of the whole std lib with and without the ast cache
+    QFETCH(bool, cached);
+    QTemporaryDir cacheDir;
+    QVERIFY(cacheDir.isValid());
+    struct CachedFile {
+        QByteArray name;
+        QByteArray source;
+        QByteArray cachePath;
+        uint64_t key;
+    };
+    QVector<CachedFile> files;
+    QDirIterator it(Zig::Helper::stdLibPath(nullptr), {QStringLiteral("*.zig")}, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QFile f(it.next());
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        CachedFile file{f.fileName().toUtf8(), f.readAll(), QByteArray(), 0};
+        if (file.source.isEmpty()) {
+            continue;
+        }
+        file.key = ast_cache_key(file.source.constData(), file.source.size());
+        file.cachePath = QStringLiteral("%1/%2.zast").arg(cacheDir.path(), QString::number(file.key, 16)).toUtf8();
+        ZigAst tree(parse_ast(file.name.constData(), file.name.size(), file.source.constData(), file.source.size(), true));
+        if (tree.data() && ast_error_count(tree.data()) == 0) {
+            QVERIFY(ast_cache_write(tree.data(), file.cachePath.constData(), file.cachePath.size()));
+            files.append(file);
+        }
+    }
+    QVERIFY(!files.isEmpty());
+
+    QBENCHMARK {
+        for (const auto &file: files) {
+            ZigAst tree(cached
+                ? ast_cache_load(file.name.constData(), file.name.size(),
+                                 file.cachePath.constData(), file.cachePath.size(),
+                                 file.source.constData(), file.source.size(), true, file.key)
+                : parse_ast(file.name.constData(), file.name.size(),
+                            file.source.constData(), file.source.size(), true));
+            QVERIFY(tree.data());
+        }
+    }
+}
+
+void DUChainTest::benchmarkAstCache_data()
+{
+    QTest::addColumn<bool>("cached");
+    QTest::newRow("parse std") << false;
+    QTest::newRow("cache std") << true;
+}
+
+void DUChainTest::benchmarkNodeTable()
+{
+    // Store a context for every node that opens one, like the builders,
+    // then look up every node
+    QFETCH(QString, path);
+    QFETCH(bool, table);
+    const ParseSessionData::Ptr data = parseStdFile(path);
+    QVERIFY(data);
+    ZAst *tree = data->ast();
+    const uint32_t n = ast_view(tree)->node_count;
+    QVector<uint32_t> contextNodes;
+    for (uint32_t i = 0; i < n; i++) {
+        if (ZigNode{tree, i}.kind() != Unknown) {
+            contextNodes.append(i);
+        }
+    }
+    DUContext *dummy = reinterpret_cast<DUContext *>(0x1000);
+    uint64_t found = 0;
+    QBENCHMARK {
+        if (table) {
+            NodeTable<DUContext *> contexts;
+            contexts.reset(n);
+            for (uint32_t i: contextNodes) {
+                contexts.insert(i, dummy);
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                found += contexts.value(i) != nullptr;
+            }
+        } else {
+            QMap<uint32_t, DUContext *> contexts;
+            for (uint32_t i: contextNodes) {
+                contexts.insert(i, dummy);
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                found += contexts.value(i) != nullptr;
+            }
+        }
+    }
+    QVERIFY(found > 0);
+    // Rough memory use of each, a map node has two pointers, the
+    // color/parent word and the key/value
+    const size_t mapBytes = contextNodes.size() * (3 * sizeof(void *) + sizeof(uint32_t) + sizeof(DUContext *));
+    const size_t tableBytes = n * (sizeof(uint32_t) + sizeof(DUContext *));
+    qDebug() << path << n << "nodes" << contextNodes.size() << "contexts"
+             << "map ~" << mapBytes << "bytes, table" << tableBytes << "bytes";
+}
+
+void DUChainTest::benchmarkNodeTable_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<bool>("table");
+    QTest::newRow("map zig/Ast.zig") << "zig/Ast.zig" << false;
+    QTest::newRow("table zig/Ast.zig") << "zig/Ast.zig" << true;
+    QTest::newRow("map os/linux.zig") << "os/linux.zig" << false;
+    QTest::newRow("table os/linux.zig") << "os/linux.zig" << true;
+}
+
+void DUChainTest::benchmarkDeclarationPasses()
+{
+    // Single pass with deferred types vs a full prebuild pass
+    QFETCH(QString, path);
+    QFETCH(bool, singlePass);
+    const ParseSessionData::Ptr data = parseStdFile(path);
+    QVERIFY(data);
+    ParseSession session(data);
+    ZigNode root = {session.ast(), 0};
+    QBENCHMARK {
+        DeclarationBuilder builder;
+        builder.setParseSession(&session);
+        builder.setSinglePass(singlePass);
+        ReferencedTopDUContext context = builder.build(session.document(), &root);
+        QVERIFY(context.data());
+    }
+    const auto stats = session.expressionCacheStats();
+    qDebug() << path << "expression cache hits" << stats.hits << "misses" << stats.misses;
+}
+
+void DUChainTest::benchmarkDeclarationPasses_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<bool>("singlePass");
+    QTest::newRow("two pass zig/Ast.zig") << "zig/Ast.zig" << false;
+    QTest::newRow("single pass zig/Ast.zig") << "zig/Ast.zig" << true;
+    QTest::newRow("two pass array_list.zig") << "array_list.zig" << false;
+    QTest::newRow("single pass array_list.zig") << "array_list.zig" << true;
+    QTest::newRow("two pass os/linux.zig") << "os/linux.zig" << false;
+    QTest::newRow("single pass os/linux.zig") << "os/linux.zig" << true;
+}
+
 } // end namespace zig
@@ -18,6 +18,8 @@
 
 #include <QObject>
 #include <QDir>
+#include <QMap>
+#include <QTemporaryDir>
 // #include "../../ziglanguagesupport.h"
 
 namespace Zig {
@@ -32,12 +34,16 @@ public:
 private Q_SLOTS:
     void initTestCase();
     void sanityTagName();
+    void sanityCheckSourceNotCopied();
     void sanityCheckFn();
     void sanityCheckVar();
     void sanityCheckStd();
     void sanityCheckBasicImport();
     void sanityCheckDuplicateImport();
     void sanityCheckThisImport();
+    void testImportOrder();
+    void testLazyImport();
+    void testLazyImportJob();
     void cleanupTestCase();
     void testVarBindings();
     void testVarBindings_data();
@@ -49,8 +55,26 @@ private Q_SLOTS:
     void testProblems_data();
 
     void sanityCheckTypeInfo();
+    void testExpressionCache();
+    void testReparse();
+
+    void benchmarkParseLineCount();
+    void benchmarkParseLineCount_data();
+    void benchmarkNodeAccess();
+    void benchmarkNodeAccess_data();
+    void benchmarkFormat();
+    void benchmarkFormat_data();
+    void benchmarkAstCache();
+    void benchmarkAstCache_data();
+    void benchmarkNodeTable();
+    void benchmarkNodeTable_data();
+    void benchmarkDeclarationPasses();
+    void benchmarkDeclarationPasses_data();
 
 private:
+    // Write each file name and contents into the directory
+    static bool writeFiles(const QTemporaryDir &dir, const QMap<QString, QByteArray> &files);
+
     QDir assetsDir;
     // LanguageSupport* m_langSupport;
 
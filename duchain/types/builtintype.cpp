@@ -376,7 +376,8 @@ int BuiltinType::bitsize(const KDevelop::IProject* project) const
 
 bool BuiltinType::isBuiltinFunc(const QString& name)
 {
-   return is_zig_builtin_fn_name(name.toUtf8().constData());
+   const QByteArray utf8 = name.toUtf8();
+   return is_zig_builtin_fn_name(utf8.constData(), utf8.size());
 }
 
 bool BuiltinType::isBuiltinType(const QString& name)
@@ -18,6 +18,7 @@
 #include "usebuilder.h"
 
 #include <language/duchain/ducontext.h>
+#include <language/duchain/topducontext.h>
 #include <language/duchain/declaration.h>
 #include <language/duchain/functiondeclaration.h>
 #include <language/duchain/classmemberdeclaration.h>
@@ -51,8 +52,29 @@ UseBuilder::UseBuilder(const KDevelop::IndexedString &document)
 {
 }
 
+void UseBuilder::buildUses(ZigNode *node)
+{
+    if (!session->hasUnchangedBodies()) {
+        UseBuilderBase::buildUses(node);
+        return;
+    }
+    // Same as the base except the kept uses refer to the indexes of the
+    // used declarations so they are not cleared
+    if (auto top = dynamic_cast<TopDUContext*>(contextFromNode(node))) {
+        DUChainWriteLocker lock;
+        if (top->features() & TopDUContext::AllDeclarationsContextsAndUses) {
+            setRecompiling(true);
+        }
+    }
+    supportBuild(node);
+}
+
 VisitResult UseBuilder::visitNode(const ZigNode &node, const ZigNode &parent)
 {
+    // The contexts of the body are not opened so their uses are kept
+    if (session->isUnchangedBody(node)) {
+        return Continue;
+    }
     NodeTag tag = node.tag();
     // qCDebug(KDEV_ZIG) << "UseBuilder::visitNode" << node.index << "tag" << tag;
     switch (tag) {
@@ -242,8 +264,8 @@ VisitResult UseBuilder::visitContainerField(const ZigNode &node, const ZigNode &
 
 VisitResult UseBuilder::visitBuiltinCall(const ZigNode &node, const ZigNode &parent)
 {
-    QString functionName = node.spellingName();
-    if (functionName == QLatin1String("@import")) {
+    const BuiltinFnId id = node.builtinId();
+    if (id == BuiltinFnId_import) {
         // Show use range on the string
         ZigNode child = node.nextChild();
         QString importName = child.spellingName();
@@ -281,7 +303,8 @@ VisitResult UseBuilder::visitBuiltinCall(const ZigNode &node, const ZigNode &par
         }
         return Continue;
     }
-    else if (!BuiltinType::isBuiltinFunc(functionName)) {
+    else if (id == BuiltinFnId_invalid) {
+        QString functionName = node.spellingName();
         RangeInRevision useRange = editorFindSpellingRange(node, functionName);
         ProblemPointer p = ProblemPointer(new Problem());
         p->setFinalLocation(DocumentRange(document, useRange.castToSimpleRange()));
@@ -329,7 +352,8 @@ VisitResult UseBuilder::visitCall(const ZigNode &node, const ZigNode &parent)
         }
     }
 
-    const auto n = node.callParamCount();
+    const auto params = node.callParams();
+    const auto n = static_cast<uint32_t>(params.size());
     const auto args = fn->arguments();
 
     // Handle implict "self" arg in struct fns
@@ -383,7 +407,7 @@ VisitResult UseBuilder::visitCall(const ZigNode &node, const ZigNode &parent)
     uint32_t i = 0;
     QMap<IndexedString, AbstractType::Ptr> resolvedArgTypes;
     for (const auto &arg: args.mid(startArg)) {
-        ZigNode argValueNode = node.callParamAt(i);
+        ZigNode argValueNode = i < n ? params.at(i) : ZigNode{node.ast, 0};
         checkAndAddFnArgUse(arg, i, argValueNode, node, resolvedArgTypes);
         i += 1;
     }
@@ -562,11 +586,11 @@ bool UseBuilder::checkAndAddStructInitUse(
     }
     auto unionType = decl->type<UnionType>();
     // TODO: Check fields
-    const auto n = structInitNode.structInitCount();
+    const auto fields = structInitNode.structInitFields();
 
     bool ok = true;
-    for (uint32_t i=0; i < n; i++) {
-        FieldInitData fieldData = structInitNode.structInitAt(i);
+    for (int i=0; i < fields.size(); i++) {
+        const FieldInitData &fieldData = fields.at(i);
         ZigNode fieldValue = {structInitNode.ast, fieldData.value_expr};
         QString fieldName = structInitNode.tokenSlice(fieldData.name_token);
         auto useRange = structInitNode.tokenRange(fieldData.name_token);
@@ -670,10 +694,10 @@ bool UseBuilder::checkAndAddArrayInitUse(
     if (Helper::isMixedType(sliceType->elementType())) {
         return true; // No point in checking
     }
-    const auto n = arrayInitNode.arrayInitCount();
+    const auto items = arrayInitNode.arrayInitItems();
     bool ok = true;
-    for (uint32_t i=0; i < n; i++) {
-        ZigNode valueNode = arrayInitNode.arrayInitAt(i);
+    for (int i=0; i < items.size(); i++) {
+        const ZigNode &valueNode = items.at(i);
         Q_ASSERT(!valueNode.isRoot());
         auto itemRange = valueNode.spellingRange();
         if (!checkAndAddArrayItemUse(sliceType->elementType(), i, valueNode, arrayInitNode, itemRange)) {
@@ -763,6 +787,8 @@ VisitResult UseBuilder::visitFieldAccess(const ZigNode &node, const ZigNode &par
     if (auto ptr = T.dynamicCast<PointerType>()) {
         T = ptr->baseType();
     }
+    // An import that was delayed when it was declared may be parsed now
+    T = Helper::resolveDelayedImport(T);
     if (auto s = T.dynamicCast<SliceType>()) {
         if (attr == QLatin1String("len") || attr == QLatin1String("ptr")) {
             return Continue; // Builtins
@@ -1166,9 +1192,8 @@ VisitResult UseBuilder::visitSwitchCase(const ZigNode &node, const ZigNode &pare
     v.startVisiting(switchTypeNode, node);
     const auto switchType = v.lastType();
 
-    const auto n = node.switchCaseCount();
-    for (uint32_t i=0; i < n; i++) {
-        ZigNode item = node.switchCaseItemAt(i);
+    const auto items = node.switchCaseItems();
+    for (const ZigNode &item : items) {
         if (item.tag() == NodeTag_enum_literal) {
             checkAndAddEnumUse(switchType, item.mainToken(), item.mainTokenRange());
         }
@@ -47,6 +47,10 @@ public:
     UseBuilder(const KDevelop::IndexedString &document);
     ~UseBuilder() override = default;
 
+    // Uses in the bodies the parse session says are unchanged are kept
+    // from the previous build so the used declarations are not cleared
+    void buildUses(ZigNode *node);
+
     virtual VisitResult visitNode(const ZigNode &node, const ZigNode &parent) override;
 
     VisitResult visitContainerField(const ZigNode &node, const ZigNode &parent);
@@ -20,36 +20,7 @@
 namespace Zig
 {
 
-
-NodeKind ZigNode::kind() const
-{
-    return ast_node_kind(ast, index);
-}
-
-NodeTag ZigNode::tag() const
-{
-    return ast_node_tag(ast, index);
-}
-
-NodeData ZigNode::data() const
-{
-    return ast_node_data(ast, index);
-}
-
-ZigNode ZigNode::nextChild() const
-{
-    return ZigNode{ast, ast_visit_one_child(ast, index)};
-}
-
-ZigNode ZigNode::lhsAsNode() const
-{
-    return ZigNode{ast, data().lhs};
-}
-
-ZigNode ZigNode::rhsAsNode() const
-{
-    return ZigNode{ast, data().rhs};
-}
+const size_t ZigNode::astViewOffset = ast_view_offset();
 
 ZigNode ZigNode::varType() const
 {
@@ -76,6 +47,34 @@ QString ZigNode::fnName() const
     return tokenSlice(ast_fn_name(ast, index));
 }
 
+// Fill a small array using one of the bulk accessors, the call is only
+// repeated when there are more items than the preallocated size
+template <typename T, typename Accessor>
+static QVarLengthArray<T, 8> bulkAccess(const ZigNode &node, Accessor accessor)
+{
+    QVarLengthArray<T, 8> result(8);
+    const uint32_t n = accessor(node.ast, node.index, result.data(), static_cast<uint32_t>(result.size()));
+    if (n > static_cast<uint32_t>(result.size())) {
+        result.resize(n);
+        accessor(node.ast, node.index, result.data(), n);
+    } else {
+        result.resize(n);
+    }
+    return result;
+}
+
+template <typename Accessor>
+static ZigNodeList bulkAccessNodes(const ZigNode &node, Accessor accessor)
+{
+    const auto indexes = bulkAccess<NodeIndex>(node, accessor);
+    ZigNodeList result;
+    result.reserve(indexes.size());
+    for (const NodeIndex i : indexes) {
+        result.append(ZigNode{node.ast, i});
+    }
+    return result;
+}
+
 uint32_t ZigNode::fnParamCount() const
 {
     return ast_fn_param_count(ast, index);
@@ -86,6 +85,11 @@ ParamData ZigNode::fnParamData(uint32_t i) const
     return ast_fn_param_at(ast, index, i);
 }
 
+ParamDataList ZigNode::fnParams() const
+{
+    return bulkAccess<ParamData>(*this, ast_fn_params);
+}
+
 uint32_t ZigNode::callParamCount() const
 {
     return ast_call_arg_count(ast, index);
@@ -96,6 +100,11 @@ ZigNode ZigNode::callParamAt(uint32_t i) const
     return ZigNode{ast, ast_call_arg_at(ast, index, i)};
 }
 
+ZigNodeList ZigNode::callParams() const
+{
+    return bulkAccessNodes(*this, ast_call_args);
+}
+
 uint32_t ZigNode::structInitCount() const
 {
     return ast_struct_init_field_count(ast, index);
@@ -106,6 +115,11 @@ FieldInitData ZigNode::structInitAt(uint32_t i) const
     return ast_struct_init_field_at(ast, index, i);
 }
 
+FieldInitDataList ZigNode::structInitFields() const
+{
+    return bulkAccess<FieldInitData>(*this, ast_struct_init_fields);
+}
+
 uint32_t ZigNode::arrayInitCount() const
 {
     return ast_array_init_item_size(ast, index);
@@ -116,6 +130,11 @@ ZigNode ZigNode::arrayInitAt(uint32_t i) const
     return ZigNode{ast, ast_array_init_item_at(ast, index, i)};
 }
 
+ZigNodeList ZigNode::arrayInitItems() const
+{
+    return bulkAccessNodes(*this, ast_array_init_items);
+}
+
 uint32_t ZigNode::switchCaseCount() const
 {
     return ast_switch_case_size(ast, index);
@@ -126,6 +145,11 @@ ZigNode ZigNode::switchCaseItemAt(uint32_t i) const
     return ZigNode{ast, ast_switch_case_item_at(ast, index, i)};
 }
 
+ZigNodeList ZigNode::switchCaseItems() const
+{
+    return bulkAccessNodes(*this, ast_switch_case_items);
+}
+
 uint32_t ZigNode::forInputCount() const
 {
     return ast_for_input_count(ast, index);
@@ -136,6 +160,11 @@ ZigNode ZigNode::forInputAt(uint32_t i) const
     return ZigNode{ast, ast_for_input_at(ast, index, i)};
 }
 
+ZigNodeList ZigNode::forInputs() const
+{
+    return bulkAccessNodes(*this, ast_for_inputs);
+}
+
 
 QString ZigNode::tokenSlice(TokenIndex i) const
 {
@@ -161,7 +190,7 @@ KDevelop::RangeInRevision ZigNode::tokenRange(uint32_t i) const
 
 KDevelop::RangeInRevision ZigNode::range() const
 {
-    SourceRange range = ast_node_range(ast, index);
+    SourceRange range = extent();
     KTextEditor::Range r = range.isEmpty() ?
     KTextEditor::Range::invalid() : KTextEditor::Range(
             range.start.line,
@@ -172,11 +201,6 @@ KDevelop::RangeInRevision ZigNode::range() const
     return KDevelop::RangeInRevision::castFromSimpleRange(r);
 }
 
-SourceRange ZigNode::extent() const
-{
-    return ast_node_range(ast, index);
-}
-
 QString ZigNode::captureName(CaptureType capture) const
 {
     return tokenSlice(ast_node_capture_token(ast, index, capture));
@@ -215,12 +239,12 @@ QString ZigNode::spellingName() const
 
 QString ZigNode::mainToken() const
 {
-    return tokenSlice(ast_node_main_token(ast, index));
+    return tokenSlice(mainTokenIndex());
 }
 
 KDevelop::RangeInRevision ZigNode::mainTokenRange() const
 {
-    return tokenRange(ast_node_main_token(ast, index));
+    return tokenRange(mainTokenIndex());
 }
 
 KDevelop::RangeInRevision ZigNode::spellingRange() const
@@ -18,6 +18,8 @@
 #ifndef ZIGNODE_H
 #define ZIGNODE_H
 
+#include <QVarLengthArray>
+
 #include <language/duchain/ducontext.h>
 
 #include "kdevzigastparser.h"
@@ -50,29 +52,125 @@ private:
 
 template <typename T> void noop_destructor(T *) {}
 
+struct ZigNode;
+// Most lists (params, args, fields...) are short enough to not need a heap allocation
+using ZigNodeList = QVarLengthArray<ZigNode, 8>;
+using ParamDataList = QVarLengthArray<ParamData, 8>;
+using FieldInitDataList = QVarLengthArray<FieldInitData, 8>;
+
 using ZigAst = ZigAllocatedObject<ZAst, destroy_ast>;
-using ZigError = ZigAllocatedObject<ZError, destroy_error>;
+using ZigErrorList = ZigAllocatedObject<ZErrorList, destroy_errors>;
+using ZigImportList = ZigAllocatedObject<ZImportList, destroy_imports>;
 
 struct KDEVZIGDUCHAIN_EXPORT ZigNode
 {
     ZAst* ast;
     uint32_t index;
 
-    NodeKind kind() const;
-    NodeTag tag() const;
-    NodeData data() const;
+    // Offset of the AstView within a ZAst, see ast_view_offset
+    static const size_t astViewOffset;
+
+    // Direct access to the ast arrays. The ast must not be null.
+    inline const AstView* view() const
+    {
+        return reinterpret_cast<const AstView*>(
+            reinterpret_cast<const char*>(ast) + astViewOffset);
+    }
+
+    inline NodeKind kind() const
+    {
+        if (ast && index < view()->node_count) {
+            return static_cast<NodeKind>(view()->node_kinds[index]);
+        }
+        return Unknown;
+    }
+
+    inline uint8_t flags() const
+    {
+        if (ast && index < view()->node_count) {
+            return view()->node_flags[index];
+        }
+        return NodeFlag_None;
+    }
+
+    inline NodeTag tag() const
+    {
+        if (ast && index < view()->node_count) {
+            return static_cast<NodeTag>(view()->node_tags[index]);
+        }
+        return NodeTag_root; // Invalid unless index == 0
+    }
+
+    inline NodeData data() const
+    {
+        if (ast && index < view()->node_count) {
+            return view()->node_data[index];
+        }
+        return NodeData{0, 0};
+    }
+
+    // Returns INVALID_TOKEN if the node is not valid
+    inline TokenIndex mainTokenIndex() const
+    {
+        if (ast && index < view()->node_count) {
+            return view()->node_main_tokens[index];
+        }
+        return INVALID_TOKEN;
+    }
+
+    // Direct children in the order they are visited
+    inline NodeSpan children() const
+    {
+        if (ast && index < view()->node_count) {
+            const uint32_t start = view()->child_offsets[index];
+            const uint32_t end = view()->child_offsets[index + 1];
+            return NodeSpan{view()->child_nodes + start, end - start};
+        }
+        return NodeSpan{nullptr, 0};
+    }
+
+    // The root is its own parent
+    inline ZigNode parent() const
+    {
+        if (ast && index < view()->node_count) {
+            return ZigNode{ast, view()->node_parents[index]};
+        }
+        return ZigNode{ast, 0};
+    }
+
     // Prefer lhsAsNode or rhsAsNode instead of nextChild when possible
-    ZigNode nextChild() const;
+    inline ZigNode nextChild() const
+    {
+        const NodeSpan nodes = children();
+        return ZigNode{ast, nodes.len > 0 ? nodes.data[0] : 0};
+    }
     // Use data lhs as a node
-    ZigNode lhsAsNode() const;
+    inline ZigNode lhsAsNode() const { return ZigNode{ast, data().lhs}; }
     // Use data rhs as a node
-    ZigNode rhsAsNode() const;
+    inline ZigNode rhsAsNode() const { return ZigNode{ast, data().rhs}; }
 
-    SourceRange extent() const;
+    // Start of the first and last token
+    inline SourceRange extent() const
+    {
+        if (ast && index < view()->node_count) {
+            return view()->node_ranges[index];
+        }
+        return SourceRange{};
+    }
     QString comment() const;
     QString spellingName() const;
     KDevelop::RangeInRevision spellingRange() const;
     QString mainToken() const;
+    // Interned id of an identifier token or INVALID_IDENT
+    inline uint32_t identId(TokenIndex token) const
+    {
+        if (ast && token < view()->token_count) {
+            return view()->token_idents[token];
+        }
+        return INVALID_IDENT;
+    }
+    // Builtin called if this is a builtin call
+    inline BuiltinFnId builtinId() const { return ast_builtin_id(ast, index); }
     // Create an anon name for a container
     QString containerName() const;
     QString tokenSlice(TokenIndex i) const;
@@ -92,25 +190,32 @@ struct KDEVZIGDUCHAIN_EXPORT ZigNode
     QString fnName() const;
     uint32_t fnParamCount() const;
     ParamData fnParamData(uint32_t i) const;
+    // Prefer these over calling the *At(i) functions in a loop
+    ParamDataList fnParams() const;
 
     // For calls
     uint32_t callParamCount() const;
     ZigNode callParamAt(uint32_t i) const;
+    ZigNodeList callParams() const;
 
     uint32_t structInitCount() const;
     FieldInitData structInitAt(uint32_t i) const;
+    FieldInitDataList structInitFields() const;
 
     uint32_t arrayInitCount() const;
     ZigNode arrayInitAt(uint32_t i) const;
+    ZigNodeList arrayInitItems() const;
 
     uint32_t switchCaseCount() const;
     ZigNode switchCaseItemAt(uint32_t i) const;
+    ZigNodeList switchCaseItems() const;
 
     uint32_t forInputCount() const;
     // This is the node in the for part
     // eg for (0.., b) |x, y} {}
     // forInputAt
     ZigNode forInputAt(uint32_t i) const;
+    ZigNodeList forInputs() const;
 
     // Access the sub range for the node
     // This range is then used to index extraData
@@ -135,8 +240,31 @@ struct KDEVZIGDUCHAIN_EXPORT ZigNode
     }
 };
 
+/**
+ * Call visitor->visitNode(child, node) for each child of node. If it
+ * returns Recurse the children of that child are visited the same way,
+ * if it returns Break the remaining siblings are skipped.
+ */
+template <typename Visitor>
+void visitChildNodes(Visitor *visitor, const ZigNode &node)
+{
+    const NodeSpan nodes = node.children();
+    for (uint32_t i = 0; i < nodes.len; i++) {
+        const ZigNode child = {node.ast, nodes.data[i]};
+        switch (visitor->visitNode(child, node)) {
+        case Break:
+            return;
+        case Recurse:
+            visitChildNodes(visitor, child);
+            break;
+        case Continue:
+            break;
+        }
+    }
+}
+
 template class KDEVZIGDUCHAIN_EXPORT ZigAllocatedObject<ZAst, destroy_ast>;
-template class KDEVZIGDUCHAIN_EXPORT ZigAllocatedObject<ZError, destroy_error>;
+template class KDEVZIGDUCHAIN_EXPORT ZigAllocatedObject<ZErrorList, destroy_errors>;
 
 }
 
@@ -26,13 +26,14 @@
 #include <language/duchain/duchainlock.h>
 #include <language/duchain/duchainutils.h>
 #include <language/codecompletion/codecompletion.h>
+#include <util/formattinghelpers.h>
 
 #include <KPluginFactory>
 
 #include <QReadWriteLock>
-#include <QStandardPaths>
 
 #include "zigparsejob.h"
+#include "duchain/helpers.h"
 #include "codecompletion/model.h"
 #include "projectconfig/projectconfigpage.h"
 #include <language/backgroundparser/backgroundparser.h>
@@ -58,6 +59,12 @@ LanguageSupport::LanguageSupport(QObject *parent, const KPluginMetaData& metaDat
 
     new CodeCompletion(this, new CompletionModel(this), name());
 
+    // Closed documents are not reparsed from the editor so their kept
+    // session is not needed anymore
+    connect(KDevelop::ICore::self()->documentController(), &KDevelop::IDocumentController::documentClosed,
+            this, [](KDevelop::IDocument *document) {
+        ParseJob::dropParseSessionData(KDevelop::IndexedString(document->url()));
+    });
 }
 
 LanguageSupport::~LanguageSupport()
@@ -84,24 +91,104 @@ ICodeHighlighting *LanguageSupport::codeHighlighting() const
     return m_highlighting;
 }
 
-SourceFormatterItemList LanguageSupport::sourceFormatterItems() const
+static SourceFormatterStyle zigFmtStyle()
 {
     SourceFormatterStyle zigFormatter(QLatin1String("zig fmt"));
     zigFormatter.setCaption(QLatin1String("zig fmt"));
     zigFormatter.setDescription(i18n("Format source with zig fmt."));
+    zigFormatter.setUsePreview(true);
     zigFormatter.setMimeTypes(SourceFormatterStyle::MimeList {
         SourceFormatterStyle::MimeHighlightPair { QLatin1String("text/zig"), QLatin1String("Zig") },
         SourceFormatterStyle::MimeHighlightPair { QLatin1String("text/x-zig"), QLatin1String("Zig") }
     });
+    return zigFormatter;
+}
+
+SourceFormatterItemList LanguageSupport::sourceFormatterItems() const
+{
+    return SourceFormatterItemList { SourceFormatterStyleItem { name(), zigFmtStyle() } };
+}
 
-    QString zigPath = QStandardPaths::findExecutable(QLatin1String("zig"));
-    if (zigPath.isEmpty()) {
-        qCDebug(KDEV_ZIG) << "Could not find the zig executable";
-        zigPath = QLatin1String("/usr/bin/zig");
+QString LanguageSupport::caption() const
+{
+    return QLatin1String("zig fmt");
+}
+
+QString LanguageSupport::description() const
+{
+    return i18n("Format source with the zig fmt renderer built into the Zig plugin.");
+}
+
+QString LanguageSupport::formatSourceWithStyle(const SourceFormatterStyle& style,
+                                               const QString& text,
+                                               const QUrl& url,
+                                               const QMimeType& mime,
+                                               const QString& leftContext,
+                                               const QString& rightContext) const
+{
+    Q_UNUSED(style);
+    Q_UNUSED(mime);
+    // zig fmt only works on whole files so a selection is formatted
+    // along with its context and extracted again afterwards
+    const QByteArray source = QString(leftContext + text + rightContext).toUtf8();
+    // If the document did not change since its last build its ast is
+    // rendered instead of parsing it again
+    const ParseSessionData::Ptr data = ParseJob::findParseSessionData(KDevelop::IndexedString(url));
+    const bool upToDate = data && data->ast() && data->source() == source;
+    const QByteArray formatted = Helper::formatSource(source, upToDate ? data->ast() : nullptr);
+    if (formatted.isNull()) {
+        qCDebug(KDEV_ZIG) << "Not formatting" << url << "since it has errors";
+        return text;
+    }
+    if (leftContext.isEmpty() && rightContext.isEmpty()) {
+        return QString::fromUtf8(formatted);
     }
-    zigFormatter.setContent(QLatin1String("%1 fmt $TMPFILE").arg(zigPath));
+    return extractFormattedTextFromContext(QString::fromUtf8(formatted), text, leftContext, rightContext);
+}
+
+ISourceFormatter::SettingsWidgetPtr LanguageSupport::editStyleWidget(const QMimeType& mime) const
+{
+    Q_UNUSED(mime);
+    // zig fmt has no options
+    return nullptr;
+}
+
+bool LanguageSupport::hasEditStyleWidget() const
+{
+    return false;
+}
 
-    return SourceFormatterItemList { SourceFormatterStyleItem { QLatin1String("customscript"), zigFormatter } };
+QString LanguageSupport::previewText(const SourceFormatterStyle& style, const QMimeType& mime) const
+{
+    Q_UNUSED(style);
+    Q_UNUSED(mime);
+    return QStringLiteral(
+        "const std = @import(\"std\");\n"
+        "\n"
+        "pub fn main() !void {\n"
+        "    const values = [_]u8{ 1, 2, 3 };\n"
+        "    for (values) |v| {\n"
+        "        std.debug.print(\"{}\\n\", .{v});\n"
+        "    }\n"
+        "}\n"
+    );
+}
+
+ISourceFormatter::Indentation LanguageSupport::indentation(const SourceFormatterStyle& style, const QUrl& url, const QMimeType& mime) const
+{
+    Q_UNUSED(style);
+    Q_UNUSED(url);
+    Q_UNUSED(mime);
+    // zig fmt always indents with 4 spaces
+    Indentation result;
+    result.indentationTabWidth = -1;
+    result.indentWidth = 4;
+    return result;
+}
+
+QVector<SourceFormatterStyle> LanguageSupport::predefinedStyles() const
+{
+    return QVector<SourceFormatterStyle> { zigFmtStyle() };
 }
 
 int LanguageSupport::perProjectConfigPages() const
@@ -22,6 +22,7 @@
 #include <interfaces/idocument.h>
 #include <interfaces/ilanguagecheck.h>
 #include <interfaces/ilanguagecheckprovider.h>
+#include <interfaces/isourceformatter.h>
 #include <language/interfaces/ilanguagesupport.h>
 
 #include <QVariant>
@@ -35,9 +36,11 @@ namespace Zig
 class KDEVPLATFORMLANGUAGE_EXPORT LanguageSupport
         : public KDevelop::IPlugin
         , public KDevelop::ILanguageSupport
+        , public KDevelop::ISourceFormatter
 {
     Q_OBJECT
     Q_INTERFACES( KDevelop::ILanguageSupport )
+    Q_INTERFACES( KDevelop::ISourceFormatter )
 
 public:
     LanguageSupport(QObject *parent, const KPluginMetaData& metaData, const QVariantList &args = QVariantList());
@@ -50,6 +53,21 @@ public:
 
     KDevelop::SourceFormatterItemList sourceFormatterItems() const override;
 
+    // ISourceFormatter, formats in-process with the zig fmt renderer
+    QString caption() const override;
+    QString description() const override;
+    QString formatSourceWithStyle(const KDevelop::SourceFormatterStyle& style,
+                                  const QString& text,
+                                  const QUrl& url,
+                                  const QMimeType& mime,
+                                  const QString& leftContext = QString(),
+                                  const QString& rightContext = QString()) const override;
+    SettingsWidgetPtr editStyleWidget(const QMimeType& mime) const override;
+    QString previewText(const KDevelop::SourceFormatterStyle& style, const QMimeType& mime) const override;
+    Indentation indentation(const KDevelop::SourceFormatterStyle& style, const QUrl& url, const QMimeType& mime) const override;
+    QVector<KDevelop::SourceFormatterStyle> predefinedStyles() const override;
+    bool hasEditStyleWidget() const override;
+
     int perProjectConfigPages() const override;
     KDevelop::ConfigPage* perProjectConfigPage(int number, const KDevelop::ProjectConfigOptions& options, QWidget* parent) override;
 
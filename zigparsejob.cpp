@@ -32,12 +32,15 @@
 #include <project/projectmodel.h>
 #include <util/path.h>
 
+#include <QHash>
+#include <QMutex>
 #include <QReadLocker>
 
 #include "duchain/parsesession.h"
 #include "duchain/kdevzigastparser.h"
 #include "duchain/declarationbuilder.h"
 #include "duchain/usebuilder.h"
+#include "duchain/importscheduler.h"
 
 #include "ziglanguagesupport.h"
 #include "zigdebug.h"
@@ -69,6 +72,24 @@ public:
 };
 #endif
 
+namespace {
+
+// The session of the last build of each open document that can be
+// reparsed against, see ParseSession::reparse
+struct KeptSessions
+{
+    QMutex mutex;
+    QHash<IndexedString, ParseSessionData::Ptr> sessions;
+};
+
+KeptSessions &keptSessions()
+{
+    static KeptSessions kept;
+    return kept;
+}
+
+}
+
 ParseJob::ParseJob(const IndexedString &url, ILanguageSupport *languageSupport)
     : KDevelop::ParseJob(url, languageSupport)
 {
@@ -82,18 +103,45 @@ LanguageSupport *ParseJob::zig() const
 
 ParseSessionData::Ptr ParseJob::findParseSessionData(const IndexedString &url)
 {
-    DUChainReadLocker lock;
-    auto context = KDevelop::DUChainUtils::standardContextForUrl(url.toUrl());
+    KeptSessions &kept = keptSessions();
+    QMutexLocker lock(&kept.mutex);
+    return kept.sessions.value(url);
+}
 
-    if (context) {
-        return ParseSessionData::Ptr(dynamic_cast<ParseSessionData *>(context->ast().data()));
-    }
+void ParseJob::dropParseSessionData(const IndexedString &url)
+{
+    takeParseSessionData(url);
+}
+
+ParseSessionData::Ptr ParseJob::takeParseSessionData(const IndexedString &url)
+{
+    KeptSessions &kept = keptSessions();
+    QMutexLocker lock(&kept.mutex);
+    return kept.sessions.take(url);
+}
 
-    return {};
+void ParseJob::keepParseSessionData(const IndexedString &url, const ParseSessionData::Ptr &data)
+{
+    KeptSessions &kept = keptSessions();
+    QMutexLocker lock(&kept.mutex);
+    kept.sessions.insert(url, data);
+}
+
+ParseMode ParseJob::parseMode()
+{
+    // Only files parsed because another file imports them skip the
+    // function bodies. Once such a file is opened it is parsed from the
+    // editor and gets the full parse then.
+    if ((minimumFeatures() & Dependency) && !contentsAvailableFromEditor()) {
+        return ParseMode_Skeleton;
+    }
+    return ParseMode_Full;
 }
 
 ParseSessionData::Ptr ParseJob::createSessionData() const
 {
+    // QByteArray is implicitly shared so the session and the ast it parses
+    // refer to the job's contents without copying them
     return ParseSessionData::Ptr(new ParseSessionData(document(), contents().contents, this, parsePriority()));
 }
 
@@ -120,16 +168,21 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
         if (readProblem) {
             return;
         }
-    }
 
-    ParseSession session(findParseSessionData(document()));
-    if (!session.data()) {
-        session.setData(createSessionData());
-    }
-    session.parse();
-
-    if (abortRequested()) {
-        return;
+        // Imports that are not parsed yet are scheduled first and this
+        // is parsed once after them instead of before and again after.
+        // Only files that are open or in a project do this, anything they
+        // import is parsed when it is needed so the std lib is not walked.
+        const bool isDependency = (minimumFeatures() & Dependency) || !(contentsAvailableFromEditor()
+            || KDevelop::ICore::self()->projectController()->findProjectForUrl(document().toUrl()));
+        if (!(minimumFeatures() & Rescheduled) && !isDependency
+                && ImportScheduler::self().scheduleImports(document(), contents().contents, parsePriority())) {
+            KDevelop::ICore::self()->languageController()->backgroundParser()->addDocument(
+                document(),
+                static_cast<TopDUContext::Features>(minimumFeatures() | Rescheduled), parsePriority(),
+                nullptr, ParseJob::FullSequentialProcessing);
+            return;
+        }
     }
 
     ReferencedTopDUContext toUpdate = nullptr;
@@ -137,10 +190,31 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
         DUChainReadLocker lock;
         toUpdate = DUChainUtils::standardContextForUrl(document().toUrl());
     }
+
+    // Always taken so a session is only reparsed against by the build
+    // right after the one that kept it
+    const ParseSessionData::Ptr previous = takeParseSessionData(document());
+    const ParseMode mode = parseMode();
+    ParseSessionData::Ptr data = createSessionData();
+    data->setAstCacheEnabled(!contentsAvailableFromEditor());
+    ParseSession session(data);
+    if (previous && toUpdate && mode == ParseMode_Full && contentsAvailableFromEditor()) {
+        session.reparse(previous);
+    } else {
+        session.parse(mode);
+    }
+
+    if (abortRequested()) {
+        return;
+    }
+
+    QList<ProblemPointer> keptProblems;
     if (toUpdate) {
         translateDUChainToRevision(toUpdate);
         DUChainWriteLocker lock; // Must come after translateDUChainToRevision
         toUpdate->setRange(RangeInRevision(0, 0, INT_MAX, INT_MAX));
+        // The use builder skips the unchanged bodies
+        keptProblems = session.unchangedBodyProblems(toUpdate.data());
         toUpdate->clearProblems();
     }
 
@@ -161,6 +235,12 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
         // must be used
         context = builder.build(document(), &root, toUpdate);
         setDuChain(context);
+        if (!keptProblems.isEmpty()) {
+            DUChainWriteLocker lock;
+            for (const auto &problem : std::as_const(keptProblems)) {
+                context->addProblem(problem);
+            }
+        }
 
         if (abortRequested()) {
             return;
@@ -194,19 +274,21 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
     }
 
     if (num_errors > 0) {
-        DUChainWriteLocker lock;
-        for (uint32_t i=0; i < num_errors; i++) {
-            ZigError error = ZigError(ast_error_at(session.ast(), i));
-            if(error.data() != nullptr) {
+        // Fetch all errors in one call before taking the lock
+        ZigErrorList errors = ZigErrorList(ast_errors(session.ast()));
+        if (errors.data() != nullptr) {
+            DUChainWriteLocker lock;
+            for (uint32_t i=0; i < errors.data()->count; i++) {
+                const ZError &error = errors.data()->errors[i];
                 ProblemPointer p = ProblemPointer(new Problem());
                 p->setFinalLocation(DocumentRange(document(), KTextEditor::Range(
-                    error.data()->range.start.line,
-                    error.data()->range.start.column,
-                    error.data()->range.end.line,
-                    error.data()->range.end.column)));
+                    error.range.start.line,
+                    error.range.start.column,
+                    error.range.end.line,
+                    error.range.end.column)));
                 p->setSource(IProblem::Parser);
-                p->setSeverity(static_cast<IProblem::Severity>(error.data()->severity));
-                p->setDescription(QString::fromUtf8(error.data()->message));
+                p->setSeverity(static_cast<IProblem::Severity>(error.severity));
+                p->setDescription(QString::fromUtf8(error.message));
                 context->addProblem(p);
             }
         }
@@ -214,10 +296,13 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
 
     // If some imports are still unresolved, reschedule it.
     // Pulled from kdev-python
-    // TODO: This needs to somehow make sure that all imports have been resolved
-    // in the dependents because each dependency can still have unresolved
-    // imports...
-    if (!session.unresolvedImports().isEmpty()) {
+    // Imports are normally parsed first (see ImportScheduler) so this is
+    // for files that import each other, which are parsed again a bounded
+    // number of times, or imports the scan did not find. Modules that
+    // were only needed once a member was accessed are parsed first too.
+    const bool demanded = ImportScheduler::self().takeDemanded(document());
+    if (demanded || !session.unresolvedImports().isEmpty()) {
+        const bool inCycle = ImportScheduler::self().shouldReparse(document(), session.unresolvedImports());
         DUChainWriteLocker lock;
 
         // If the dependencies were not scheduled for some reason
@@ -231,7 +316,7 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
             }
         }
 
-        if (!(minimumFeatures() & Rescheduled) && dependencyInQueue) {
+        if (demanded || inCycle || (!(minimumFeatures() & Rescheduled) && dependencyInQueue)) {
             constexpr TopDUContext::Features features{TopDUContext::ForceUpdate};
             KDevelop::ICore::self()->languageController()->backgroundParser()->addDocument(
                 document(),
@@ -249,6 +334,15 @@ void ParseJob::run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread)
         DUChain::self()->updateContextEnvironment(context->topContext(), file.data());
     }
 
+    // Keep the session of an open document that is complete so the next
+    // edit of it is reparsed against it. It is built again anyway if
+    // anything it uses was missing.
+    if (num_errors == 0 && mode == ParseMode_Full && contentsAvailableFromEditor()
+            && !demanded && session.unresolvedImports().isEmpty() && !abortRequested()) {
+        session.releaseBuildState();
+        keepParseSessionData(document(), data);
+    }
+
     highlightDUChain();
     DUChain::self()->emitUpdateReady(document(), duChain());
     qCDebug(KDEV_ZIG) << "Parse job finished for: " << document().toUrl();
@@ -25,6 +25,7 @@
 #include <language/duchain/problem.h>
 
 #include "duchain/parsesession.h"
+#include "duchain/importscheduler.h"
 
 namespace Zig
 {
@@ -41,15 +42,24 @@ public:
     enum CustomFeatures {
         Rescheduled = (KDevelop::TopDUContext::LastFeature << 1),
         AttachASTWithoutUpdating = (Rescheduled << 1), ///< Used when context is up to date, but has no AST attached.
-        UpdateHighlighting = (AttachASTWithoutUpdating << 1) ///< Used when we only need to update highlighting
+        UpdateHighlighting = (AttachASTWithoutUpdating << 1), ///< Used when we only need to update highlighting
+        Dependency = ImportScheduler::DependencyFeature ///< Only parsed because another file imports it
     };
 
+    // Session of the last build of an open document, only its ast and
+    // contents are valid. Does not need the UrlParseLock.
     static ParseSessionData::Ptr findParseSessionData(const KDevelop::IndexedString &url);
+    // Called when the document is closed
+    static void dropParseSessionData(const KDevelop::IndexedString &url);
 protected:
     void run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread *thread) override;
 
 private:
     QExplicitlySharedDataPointer<ParseSessionData> createSessionData() const;
+    static ParseSessionData::Ptr takeParseSessionData(const KDevelop::IndexedString &url);
+    static void keepParseSessionData(const KDevelop::IndexedString &url, const ParseSessionData::Ptr &data);
+    // Skeleton for dependencies that are not open, otherwise full
+    ParseMode parseMode();
     LanguageSupport *zig() const;
 
 };